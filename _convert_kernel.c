@@ -0,0 +1,145 @@
+/*
+ * Optional native version of the str.translate path of
+ * char_converter._translate, built with:
+ *
+ *     python3 setup.py build_ext --inplace
+ *
+ * char_converter uses it when it can be imported, the output is the same.
+ */
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+/* see font_tables.py */
+#define F_KNOWN 1
+
+/*
+ * convert(s, flags, out, high_slots) -> (text, rest)
+ *
+ * flags (bytes or a buffer, like a view of the mapped compiled file) and
+ * out (list of str) are indexed by slot, high_slots is
+ * the dict of the slots of the code points > 255. text is the conversion
+ * of s (unknown characters removed), rest has the characters of s that
+ * are not plain (unknown, error or divergent), for the stats.
+ */
+static PyObject *
+convert(PyObject *self, PyObject *args)
+{
+    PyObject *s, *out, *high_slots;
+    PyObject *text = NULL, *rest = NULL, *res = NULL;
+    Py_ssize_t *slots = NULL;
+    Py_buffer flags_buf;
+
+    if (!PyArg_ParseTuple(args, "Uy*O!O!", &s, &flags_buf,
+                          &PyList_Type, &out, &PyDict_Type, &high_slots))
+        return NULL;
+
+    Py_ssize_t n = PyUnicode_GET_LENGTH(s);
+    int kind = PyUnicode_KIND(s);
+    const void *data = PyUnicode_DATA(s);
+    const unsigned char *flags = (const unsigned char *)flags_buf.buf;
+    Py_ssize_t nb_slots = flags_buf.len;
+    if (PyList_GET_SIZE(out) < nb_slots) {
+        PyErr_SetString(PyExc_ValueError, "out is shorter than flags");
+        goto done;
+    }
+
+    slots = PyMem_Malloc((n > 0 ? n : 1) * sizeof(Py_ssize_t));
+    if (slots == NULL) {
+        PyErr_NoMemory();
+        goto done;
+    }
+
+    /* first pass: slot of each character, lengths and max chars */
+    Py_ssize_t text_len = 0, rest_len = 0;
+    Py_UCS4 text_max = 0, rest_max = 0;
+    for (Py_ssize_t i = 0; i < n; i++) {
+        Py_UCS4 cp = PyUnicode_READ(kind, data, i);
+        Py_ssize_t slot = -1;
+        if (cp < 256) {
+            slot = cp;
+        } else {
+            PyObject *key = PyLong_FromUnsignedLong(cp);
+            if (key == NULL)
+                goto done;
+            PyObject *value = PyDict_GetItemWithError(high_slots, key);
+            Py_DECREF(key);
+            if (value != NULL) {
+                slot = PyLong_AsSsize_t(value);
+                if (slot == -1 && PyErr_Occurred())
+                    goto done;
+            } else if (PyErr_Occurred()) {
+                goto done;
+            }
+        }
+        unsigned char f = (slot >= 0 && slot < nb_slots) ? flags[slot] : 0;
+        if (f == 0) {
+            slot = -1;
+        } else {
+            PyObject *o = PyList_GET_ITEM(out, slot);
+            if (!PyUnicode_Check(o)) {
+                PyErr_SetString(PyExc_TypeError, "out must be a list of str");
+                goto done;
+            }
+            text_len += PyUnicode_GET_LENGTH(o);
+            Py_UCS4 m = PyUnicode_MAX_CHAR_VALUE(o);
+            if (m > text_max)
+                text_max = m;
+        }
+        if (f != F_KNOWN) {
+            rest_len++;
+            if (cp > rest_max)
+                rest_max = cp;
+        }
+        slots[i] = slot;
+    }
+
+    /* second pass: copy */
+    text = PyUnicode_New(text_len, text_max);
+    rest = PyUnicode_New(rest_len, rest_max);
+    if (text == NULL || rest == NULL)
+        goto done;
+    int rest_kind = PyUnicode_KIND(rest);
+    void *rest_data = PyUnicode_DATA(rest);
+    Py_ssize_t text_pos = 0, rest_pos = 0;
+    for (Py_ssize_t i = 0; i < n; i++) {
+        Py_ssize_t slot = slots[i];
+        if (slot >= 0) {
+            PyObject *o = PyList_GET_ITEM(out, slot);
+            Py_ssize_t len = PyUnicode_GET_LENGTH(o);
+            if (len > 0) {
+                if (PyUnicode_CopyCharacters(text, text_pos, o, 0, len) < 0)
+                    goto done;
+                text_pos += len;
+            }
+        }
+        if (slot < 0 || flags[slot] != F_KNOWN) {
+            PyUnicode_WRITE(rest_kind, rest_data, rest_pos, PyUnicode_READ(kind, data, i));
+            rest_pos++;
+        }
+    }
+    res = PyTuple_Pack(2, text, rest);
+
+done:
+    PyBuffer_Release(&flags_buf);
+    PyMem_Free(slots);
+    Py_XDECREF(text);
+    Py_XDECREF(rest);
+    return res;
+}
+
+static PyMethodDef methods[] = {
+    {"convert", convert, METH_VARARGS,
+     "convert(s, flags, out, high_slots) -> (text, rest)"},
+    {NULL, NULL, 0, NULL}
+};
+
+static struct PyModuleDef module = {
+    PyModuleDef_HEAD_INIT, "_convert_kernel", NULL, -1, methods
+};
+
+PyMODINIT_FUNC
+PyInit__convert_kernel(void)
+{
+    return PyModule_Create(&module);
+}
@@ -0,0 +1,132 @@
+import argparse
+import hashlib
+import json
+import os
+from pathlib import Path
+
+from font_tables import font_versions
+
+# Manifest of a deduff_folder run: a JSON lines file with one entry per
+# converted (or failed) PDF, appended as soon as the file is done, so that
+# a run that crashes or is interrupted can be resumed where it stopped. A
+# later entry for the same input replaces the earlier ones. An entry is:
+#   input, output: paths
+#   size, mtime, sha256: of the input when it was converted
+#   options: options_key() of the run
+#   tables: font_tables.tables_version() of the run
+#   fonts: font name -> version of its table (font_tables.font_versions),
+#          for the fonts of the file, None for the fonts without table
+#   status: "done", "timeout" or "error" (with the message in error)
+#   seconds: wall time of the conversion
+
+def file_sha256(path):
+    h = hashlib.sha256()
+    with open(path, 'rb') as in_file:
+        for chunk in iter(lambda: in_file.read(1 << 20), b""):
+            h.update(chunk)
+    return h.hexdigest()
+
+def options_key(options):
+    """
+    short hash of the options changing the output
+    """
+    return hashlib.sha256(json.dumps(options, sort_keys=True).encode()).hexdigest()[:16]
+
+def input_entry(path):
+    st = os.stat(path)
+    return {"input": str(path), "size": st.st_size, "mtime": st.st_mtime}
+
+def changed_fonts(entry):
+    """
+    the fonts of a manifest entry whose table is not the one the file was
+    converted with
+    """
+    fonts = entry["fonts"]
+    current = font_versions(fonts)
+    return sorted(font_name for font_name in fonts if current[font_name] != fonts[font_name])
+
+class Manifest:
+    def __init__(self, filename):
+        self.filename = filename
+        self.entries = {}
+        if os.path.exists(filename):
+            with open(filename) as f:
+                for line in f:
+                    try:
+                        entry = json.loads(line)
+                    except ValueError:
+                        # last line of an interrupted run
+                        continue
+                    self.entries[entry["input"]] = entry
+        self.fp = None
+
+    def is_up_to_date(self, path, txt_path, options, tables, retry_failed=False):
+        """
+        True if path was converted (or failed, unless retry_failed) with the
+        same options, tables and content, and its output is still there;
+        the content is checked by size and mtime, then by hash if only the
+        mtime changed (files copied or touched)
+
+        for converted files, only the tables of the fonts of the file are
+        compared: a table edit only makes the files using that font (or
+        using a font that now has a table) out of date
+        """
+        entry = self.entries.get(str(path))
+        if entry is None or entry.get("options") != options:
+            return False
+        if entry["status"] == "done" and "fonts" in entry:
+            if changed_fonts(entry):
+                return False
+        elif entry.get("tables") != tables:
+            return False
+        if entry["status"] == "done":
+            if not Path(txt_path).exists():
+                return False
+        elif retry_failed:
+            return False
+        current = input_entry(path)
+        if current["size"] != entry["size"]:
+            return False
+        if current["mtime"] == entry["mtime"]:
+            return True
+        if file_sha256(path) != entry.get("sha256"):
+            return False
+        # same content, the new mtime spares the hash next time
+        entry.update(current)
+        self.record(entry)
+        return True
+
+    def affected(self):
+        """
+        yields (entry, changed fonts) for the converted files that use a
+        font whose table changed since their conversion
+        """
+        for entry in self.entries.values():
+            if entry["status"] == "done" and "fonts" in entry:
+                changed = changed_fonts(entry)
+                if changed:
+                    yield entry, changed
+
+    def record(self, entry):
+        if self.fp is None:
+            self.fp = open(self.filename, "a")
+        self.entries[entry["input"]] = entry
+        self.fp.write(json.dumps(entry) + "\n")
+        self.fp.flush()
+        os.fsync(self.fp.fileno())
+
+    def close(self):
+        if self.fp is not None:
+            self.fp.close()
+            self.fp = None
+
+if __name__ == "__main__":
+    argparser = argparse.ArgumentParser(description="list the outputs of a manifest affected by table changes since their conversion")
+    argparser.add_argument("manifest")
+    args = argparser.parse_args()
+    manifest = Manifest(args.manifest)
+    nb_affected = 0
+    for entry, changed in manifest.affected():
+        nb_affected += 1
+        print("%s,%s" % (entry["output"], " ".join(changed)))
+    print("%d of %d outputs affected" % (nb_affected, len(manifest.entries)))
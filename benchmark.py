@@ -0,0 +1,223 @@
+import argparse
+import json
+import os
+import platform
+import random
+import sys
+import tempfile
+import timeit
+from io import StringIO
+from multiprocessing import get_context
+from pathlib import Path
+
+sys.path.append(os.path.join(os.path.dirname(os.path.abspath(__file__)), "font-tables-import"))
+from create_all_chars_rtf import font_list_attu, font_list_udp, non_uni_cp_to_uni_cp
+import char_converter
+from char_converter import convert_string, new_stats
+from font_tables import get_compiled_tables
+from timings import peak_rss
+
+# Benchmarks of the conversion, the results are printed as JSON lines:
+#   micro: convert_string on random runs of glyphs of each font family
+#   corpus: pages per second on synthetic PDFs (needs pdfminer)
+#   native: convert_string with and without the native kernel (see
+#           _convert_kernel.c) for each family, then a check that both
+#           give the same output on all the code points of all the fonts
+#   memory: peak RSS of the conversion of a long synthetic PDF, in a fresh
+#           process (needs pdfminer)
+# The inputs are generated from a fixed seed and each timing is the best of
+# several repeats, so that numbers of different runs can be compared.
+
+FAMILIES = {
+    "Ededris": "Ededris-a",
+    "TibetanMachineWeb": "TibetanMachineWeb",
+    "Chogyal": "TibetanChogyal",
+    "LTibetan": "LTibetan",
+}
+
+# fonts of the synthetic PDFs
+CORPUS_FONTS = ["Ededris-a", "Ededris-b", "Ededris-vowa", "TibetanMachineWeb", "TibetanMachineWeb1", "TibetanChogyal", "LTibetan"]
+
+def glyph_bytes(font_name):
+    """
+    the bytes of the glyphs of a font, as in the RTF files of
+    create_all_chars_rtf.py
+    """
+    maxc = 255
+    for font_list in [font_list_attu, font_list_udp]:
+        if font_name in font_list:
+            maxc = font_list[font_name]["maxc"]
+    return [i for i in range(33, maxc+1) if non_uni_cp_to_uni_cp(i) is not None]
+
+def glyph_chars(font_name):
+    return [chr(non_uni_cp_to_uni_cp(i)) for i in glyph_bytes(font_name)]
+
+def random_runs(chars, nb_runs, run_len, rng):
+    return ["".join(rng.choice(chars) for _ in range(run_len)) for _ in range(nb_runs)]
+
+def bench_micro(args):
+    get_compiled_tables()
+    for family, font_name in FAMILIES.items():
+        rng = random.Random(args.seed)
+        runs = random_runs(glyph_chars(font_name), 2000, 40, rng)
+        def convert_all():
+            stats = new_stats()
+            for run in runs:
+                convert_string(run, font_name, stats)
+        # first call builds the translate tables
+        convert_all()
+        best = min(timeit.repeat(convert_all, number=1, repeat=args.repeat))
+        nb_glyphs = sum(len(run) for run in runs)
+        yield {"bench": "micro", "family": family, "font": font_name, "glyphs": nb_glyphs, "seconds": best, "glyphs_per_sec": nb_glyphs / best}
+
+def bench_native(args):
+    native_convert = char_converter.native_convert
+    if native_convert is None:
+        yield {"bench": "native", "error": "_convert_kernel is not built"}
+        return
+    tables = get_compiled_tables()
+    try:
+        for family, font_name in FAMILIES.items():
+            rng = random.Random(args.seed)
+            runs = random_runs(glyph_chars(font_name), 2000, 40, rng)
+            res = {"bench": "native", "family": family, "font": font_name}
+            outputs = {}
+            for name, kernel in [("python", None), ("native", native_convert)]:
+                char_converter.native_convert = kernel
+                def convert_all():
+                    stats = new_stats()
+                    return [convert_string(run, font_name, stats) for run in runs], stats.to_dict()
+                outputs[name] = convert_all()
+                res[name + "_seconds"] = min(timeit.repeat(convert_all, number=1, repeat=args.repeat))
+            res["same_output"] = outputs["python"] == outputs["native"]
+            res["speedup"] = res["python_seconds"] / res["native_seconds"]
+            yield res
+        # all the code points of all the fonts, with the stats
+        mismatched = []
+        for name in tables:
+            s = "".join(chr(cp) for cp, _ in tables[name].code_points())
+            char_converter.native_convert = None
+            stats = new_stats()
+            expected = convert_string(s, name, stats), stats.to_dict()
+            char_converter.native_convert = native_convert
+            stats = new_stats()
+            if (convert_string(s, name, stats), stats.to_dict()) != expected:
+                mismatched.append(name)
+        yield {"bench": "native", "check": "all_code_points", "fonts": len(tables), "mismatched_fonts": mismatched}
+    finally:
+        char_converter.native_convert = native_convert
+
+def pdf_string(b):
+    return "<%s>" % b.hex()
+
+def write_synthetic_pdf(filename, nb_pages, seed, lines_per_page=20, glyphs_per_line=60):
+    """
+    writes a PDF with lines of random glyphs of CORPUS_FONTS, the fonts are
+    not embedded, pdfminer only needs their names and widths
+    """
+    rng = random.Random(seed)
+    objs = []
+    def add(obj):
+        objs.append(obj)
+        return len(objs)
+    catalog = add(None)
+    pages = add(None)
+    fonts = {}
+    for i, font_name in enumerate(CORPUS_FONTS):
+        widths = " ".join(["500"] * 224)
+        fonts["F%d" % i] = add("<< /Type /Font /Subtype /TrueType /BaseFont /ABCDEF+%s /FirstChar 32 /LastChar 255 /Widths [%s] /Encoding /WinAnsiEncoding >>" % (font_name, widths))
+    font_res = " ".join("/%s %d 0 R" % (name, num) for name, num in fonts.items())
+    glyphs = {name: glyph_bytes(font_name) for name, font_name in zip(fonts, CORPUS_FONTS)}
+    page_nums = []
+    for _ in range(nb_pages):
+        ops = ["BT"]
+        for line in range(lines_per_page):
+            ops.append("1 0 0 1 50 %d Tm" % (1350 - line * 60))
+            x = 0
+            while x < glyphs_per_line:
+                name = rng.choice(list(fonts))
+                run = bytes(rng.choice(glyphs[name]) for _ in range(rng.randint(5, 20)))
+                ops.append("/%s 24 Tf %s Tj" % (name, pdf_string(run)))
+                x += len(run)
+        ops.append("ET")
+        content = "\n".join(ops).encode("latin-1")
+        contents = add(b"<< /Length %d >>\nstream\n" % len(content) + content + b"\nendstream")
+        page_nums.append(add("<< /Type /Page /Parent %d 0 R /MediaBox [0 0 1700 1400] /Resources << /Font << %s >> >> /Contents %d 0 R >>" % (pages, font_res, contents)))
+    objs[catalog-1] = "<< /Type /Catalog /Pages %d 0 R >>" % pages
+    objs[pages-1] = "<< /Type /Pages /Kids [%s] /Count %d >>" % (" ".join("%d 0 R" % num for num in page_nums), nb_pages)
+    with open(filename, "wb") as f:
+        f.write(b"%PDF-1.4\n")
+        offsets = []
+        for num, obj in enumerate(objs, 1):
+            offsets.append(f.tell())
+            if isinstance(obj, str):
+                obj = obj.encode("latin-1")
+            f.write(b"%d 0 obj\n" % num + obj + b"\nendobj\n")
+        xref = f.tell()
+        f.write(b"xref\n0 %d\n0000000000 65535 f \n" % (len(objs) + 1))
+        for offset in offsets:
+            f.write(b"%010d 00000 n \n" % offset)
+        f.write(b"trailer\n<< /Size %d /Root %d 0 R >>\nstartxref\n%d\n%%%%EOF\n" % (len(objs) + 1, catalog, xref))
+
+def convert_pdf(pdf_file_name, options):
+    from deduff_pdf import deduff_pdf_to_sink
+    stats = new_stats(timings=True)
+    deduff_pdf_to_sink(pdf_file_name, StringIO(), stats=stats, **options)
+    return stats
+
+def bench_corpus(args, tmpdir):
+    pdf_file_name = str(Path(tmpdir) / "corpus.pdf")
+    write_synthetic_pdf(pdf_file_name, args.pages, args.seed)
+    get_compiled_tables()
+    for name, options in [("default", {}), ("fast_layout", {"fast_layout": True})]:
+        best = None
+        for _ in range(args.repeat):
+            timings = convert_pdf(pdf_file_name, options).timings
+            if best is None or timings.seconds < best.seconds:
+                best = timings
+        res = {"bench": "corpus", "mode": name}
+        res.update(best.to_dict(pages=False))
+        yield res
+
+def _memory_run(pdf_file_name, options):
+    before = peak_rss()
+    timings = convert_pdf(pdf_file_name, options).timings
+    return before, peak_rss(), timings.to_dict(pages=False)
+
+def bench_memory(args, tmpdir):
+    pdf_file_name = str(Path(tmpdir) / "long.pdf")
+    write_synthetic_pdf(pdf_file_name, args.long_pages, args.seed)
+    # a new process for each run, so that the peak RSS is only the one of
+    # this conversion
+    ctx = get_context("spawn")
+    for name, options in [("default", {}), ("fast_layout", {"fast_layout": True})]:
+        with ctx.Pool(1) as pool:
+            before, after, timings = pool.apply(_memory_run, (pdf_file_name, options))
+        yield {"bench": "memory", "mode": name, "pages": args.long_pages, "rss_before_kb": before, "max_rss_kb": after, "seconds": timings["seconds"]}
+
+if __name__ == "__main__":
+    argparser = argparse.ArgumentParser(description="benchmarks of the conversion")
+    argparser.add_argument("benches", nargs="*", choices=["micro", "native", "corpus", "memory"], default=["micro", "corpus", "memory"])
+    argparser.add_argument("--repeat", type=int, default=5, help="number of runs of each timing, the best is kept")
+    argparser.add_argument("--seed", type=int, default=0)
+    argparser.add_argument("--pages", type=int, default=20, help="pages of the corpus PDF")
+    argparser.add_argument("--long-pages", type=int, default=500, help="pages of the PDF of the memory benchmark")
+    args = argparser.parse_args()
+    try:
+        import pdfminer
+        pdfminer_version = pdfminer.__version__
+    except ImportError:
+        pdfminer_version = None
+    print(json.dumps({"python": platform.python_version(), "pdfminer": pdfminer_version, "machine": platform.machine(), "seed": args.seed}))
+    with tempfile.TemporaryDirectory() as tmpdir:
+        for bench in args.benches:
+            if bench == "micro":
+                results = bench_micro(args)
+            elif bench == "native":
+                results = bench_native(args)
+            elif bench == "corpus":
+                results = bench_corpus(args, tmpdir)
+            else:
+                results = bench_memory(args, tmpdir)
+            for res in results:
+                print(json.dumps(res))
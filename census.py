@@ -0,0 +1,106 @@
+import argparse
+import csv
+from multiprocessing import Pool
+from pathlib import Path
+
+from pdfminer.pdfdevice import PDFDevice
+from pdfminer.pdffont import PDFUnicodeNotDefined
+from pdfminer.pdfinterp import PDFResourceManager, PDFPageInterpreter
+
+from char_converter import convert_string, new_stats, merge_stats
+from deduff_pdf import _init_worker, _pdf_pages, print_stats
+from font_tables import get_compiled_tables
+
+# Census of the fonts and unknown characters of PDFs, for triage: the
+# pages are interpreted but the characters go straight from the text
+# strings to convert_string, without layout analysis, positions or output
+# text, so it costs a fraction of a conversion. The stats are the ones of
+# a conversion of the whole pages (no region), except that the font counts
+# are per text string of the content streams instead of per run.
+
+class CensusDevice(PDFDevice):
+    def __init__(self, rsrcmgr, stats):
+        super().__init__(rsrcmgr)
+        self.stats = stats
+
+    def render_string(self, textstate, seq, ncs, graphicstate):
+        font = textstate.font
+        if font is None:
+            return
+        chars = []
+        for obj in seq:
+            if isinstance(obj, (int, float)):
+                continue
+            for cid in font.decode(obj):
+                try:
+                    chars.append(font.to_unichr(cid))
+                except PDFUnicodeNotDefined:
+                    # as pdfminer's layout analysis
+                    chars.append("(cid:%d)" % cid)
+        if chars:
+            convert_string("".join(chars), font.fontname, self.stats)
+
+def census_pdf(pdf_file_name, stats=None):
+    """
+    returns the stats of the census of a PDF
+    """
+    if stats is None:
+        stats = new_stats()
+    with open(pdf_file_name, 'rb') as in_file:
+        rsrcmgr = PDFResourceManager()
+        device = CensusDevice(rsrcmgr, stats)
+        interpreter = PDFPageInterpreter(rsrcmgr, device)
+        for _, page in _pdf_pages(in_file):
+            interpreter.process_page(page)
+    return stats
+
+def _census_file(path):
+    return path, census_pdf(path)
+
+def write_census_csv(stats, csv_file):
+    """
+    writes the unknown characters of all the files as font,code point,??(c)
+    followed by the number of occurrences, the most frequent first
+    """
+    rows = []
+    for font_name, chars in stats.to_dict()["unknown_characters"].items():
+        for c, count in chars.items():
+            rows.append((font_name, ord(c), "??(%s)" % c, count))
+    rows.sort(key=lambda row: (-row[3], row[0], row[1]))
+    with open(csv_file, "w", newline="") as f:
+        csv.writer(f).writerows(rows)
+
+def census_folder(input_folder="input/", csv_file="census.csv", jobs=1):
+    """
+    census of all the PDFs of a folder, the stats are merged, printed and
+    the unknown characters written in csv_file
+    """
+    paths = sorted(Path(input_folder).glob("*.pdf"))
+    total_stats = new_stats()
+    # see deduff_folder
+    get_compiled_tables()
+    if jobs == 1:
+        results = map(_census_file, paths)
+        pool = None
+    else:
+        pool = Pool(jobs, initializer=_init_worker)
+        results = pool.imap(_census_file, paths, chunksize=1)
+    try:
+        for path, stats in results:
+            print(path)
+            merge_stats(total_stats, stats)
+    finally:
+        if pool is not None:
+            pool.close()
+            pool.join()
+    write_census_csv(total_stats, csv_file)
+    print_stats(total_stats)
+    return total_stats
+
+if __name__ == "__main__":
+    argparser = argparse.ArgumentParser(description="inventory of the fonts and unknown characters of PDFs, without conversion")
+    argparser.add_argument("input_folder", nargs="?", default="input/")
+    argparser.add_argument("--csv", default="census.csv", help="CSV file of the unknown characters of all the files")
+    argparser.add_argument("-j", "--jobs", type=int, default=1, help="number of worker processes, 0 for one per CPU")
+    args = argparser.parse_args()
+    census_folder(args.input_folder, args.csv, jobs=args.jobs or None)
@@ -1,42 +1,100 @@
-import csv
 import logging
+import re
+from collections import Counter
+from timings import Timings
+try:
+    # optional, see _convert_kernel.c
+    from _convert_kernel import convert as native_convert
+except ImportError:
+    native_convert = None
+from font_tables import F_DIVERGENT, F_ERROR, get_compiled_tables
+# kept importable from here
+from font_tables import FONT_ALIASES, EDEDRIS_PREFIXES, normalize_font_name
 
-BASE = None
-UTFC_BASE = None
-ERROR_CHR = "༠༠༠༠"
 DEBUGMODE = False
+# reorder the marks of each stack in the text of each page (not of each
+# run: the vowels of a stack can come from another font, as Ededris-vowa),
+# see reorder_stacks
+REORDER = False
 
-def get_base():
-    global BASE
-    if BASE is not None:
-        return BASE
-    BASE = get_base_from_file('font-tables/tiblegenc.csv')
-    return BASE
-
-def get_utfc_base():
-    global UTFC_BASE
-    if UTFC_BASE is not None:
-        return UTFC_BASE
-    UTFC_BASE = get_base_from_file('font-tables/utfc.csv')
-    return UTFC_BASE
-
-def get_base_from_file(filename):
-    base = {}
-    with open(filename, newline='') as csvfile:
-        base = {}
-        reader = csv.reader(csvfile, quotechar='"')
-        for row in reader:
-            if row[0] not in base:
-                base[row[0]] = {}
-            base[row[0]][chr(int(row[1]))] = row[2]
-    return base
-
-FONT_ALIASES = {
-    "Dedris-syma": "Ededris-sym",
-    "Ededris-syma": "Ededris-sym",
-    "TibetanClassicSkt": "TibetanClassicSkt1",
-    "TibetanChogyalSkt": "TibetanChogyalSkt1",
-}
+# raw PDF font name -> (font name, table)
+RESOLVED_FONTS = {}
+
+def resolve_font(raw_font_name):
+    """
+    returns (font name, table), the table being None for unhandled fonts,
+    cached for each raw font name
+    """
+    res = RESOLVED_FONTS.get(raw_font_name)
+    if res is None:
+        font_name = normalize_font_name(raw_font_name)
+        res = (font_name, get_compiled_tables().get(font_name))
+        RESOLVED_FONTS[raw_font_name] = res
+    return res
+
+class Stats:
+    """
+    the counts of the conversion: runs of each font and, for each font,
+    counts of the characters that are not plain (unknown, error or
+    divergent, see FontTable.translate_tables). The usual stats dict is
+    built by to_dict() when the stats are reported.
+
+    timings is a timings.Timings when the conversion is instrumented.
+    """
+    __slots__ = ("unhandled_fonts", "handled_fonts", "special_chars", "timings")
+
+    def __init__(self, timings=None):
+        self.unhandled_fonts = Counter()
+        self.handled_fonts = Counter()
+        # font name -> Counter of characters
+        self.special_chars = {}
+        self.timings = timings
+
+    def merge(self, other):
+        self.unhandled_fonts.update(other.unhandled_fonts)
+        self.handled_fonts.update(other.handled_fonts)
+        for font_name, chars in other.special_chars.items():
+            if font_name in self.special_chars:
+                self.special_chars[font_name].update(chars)
+            else:
+                self.special_chars[font_name] = Counter(chars)
+        if self.timings is not None and other.timings is not None:
+            self.timings.merge(other.timings)
+
+    def to_dict(self):
+        res = {
+            "unhandled_fonts": dict(self.unhandled_fonts),
+            "handled_fonts": dict(self.handled_fonts),
+            "unknown_characters": {},
+            "error_characters": 0,
+            "diffs_with_utfc": {}
+        }
+        tables = get_compiled_tables()
+        for font_name, chars in self.special_chars.items():
+            table = tables[font_name]
+            for char, nb in chars.items():
+                cp = ord(char)
+                slot = table.slot(cp)
+                f = table.flags[slot] if slot >= 0 else 0
+                if f == 0:
+                    if font_name not in res["unknown_characters"]:
+                        res["unknown_characters"][font_name] = {}
+                    res["unknown_characters"][font_name][char] = nb
+                elif f & F_DIVERGENT:
+                    res["diffs_with_utfc"]["%s,%d" % (font_name, cp)] = nb
+                elif f & F_ERROR:
+                    res["error_characters"] += nb
+        return res
+
+def new_stats(timings=False):
+    return Stats(Timings() if timings else None)
+
+def merge_stats(total, stats):
+    """
+    adds the counts of stats into total
+    """
+    total.merge(stats)
+    return total
 
 def uni_char_from_encoding(nonunicp, encoding="cp1252"):
     noncpbytes = nonunicp.to_bytes(1, "big")
@@ -46,63 +104,117 @@ def uni_char_from_encoding(nonunicp, encoding="cp1252"):
     except UnicodeDecodeError:
         return
 
-def _convert_char(char, font_name, stats):
-    base = get_base()
-    utfc_base = get_utfc_base()
-    if char == "\u00a0":
-        char = " "
-    base_ft = base.get(font_name)
-    utfc_base_ft = utfc_base.get(font_name)
-    if (base_ft is None or char not in base_ft) and (utfc_base_ft is None or char not in utfc_base_ft):
-        if font_name not in stats["unknown_characters"]:
-            stats["unknown_characters"][font_name] = {}
-        if char not in stats["unknown_characters"][font_name]:
-            stats["unknown_characters"][font_name][char] = 0
-        stats["unknown_characters"][font_name][char] += 1
-        #logging.error("unknown character: '%s' (%d) in %s" % (char, ord(char), font_name))
-        if DEBUGMODE:
-            #return "%s,%d,?(%s)" % (font_name, ord(char), char)
-            return "[[%s]]" % (char)
-        else:
-            return ""
-    res = base_ft.get(char) if base_ft is not None else None
-    utfc_res = utfc_base_ft.get(char) if utfc_base_ft is not None else None
-    if res is not None and utfc_res is not None and res != utfc_res:
-        stats_key = "%s,%d" % (font_name, ord(char))
-        if stats_key not in stats["diffs_with_utfc"]:
-            stats["diffs_with_utfc"][stats_key] = 0
-        stats["diffs_with_utfc"][stats_key] += 1
-        if DEBUGMODE:
-            return "[[%s,%d,%s or %s]]" % (font_name, ord(char), res, utfc_res)
-        else:
-            return res
-    if res == ERROR_CHR:
-        stats["error_characters"] += 1
-        if DEBUGMODE:
-            return '[[ERR]]'
-        else:
-            return ''
-    return res if res is not None else utfc_res
+def _translate(s, table, stats):
+    if native_convert is not None and not DEBUGMODE:
+        s, rest = native_convert(s, table.flags, table.out, table.high_slots)
+    else:
+        trans, plain = table.translate_tables()
+        rest = s.translate(plain)
+        s = s.translate(table.debug_translate_table() if DEBUGMODE else trans)
+    if rest:
+        chars = stats.special_chars.get(table.name)
+        if chars is None:
+            chars = stats.special_chars[table.name] = Counter()
+        chars.update(rest)
+    return s
 
 def convert_string(s, font_name, stats):
-    if font_name in FONT_ALIASES:
-        font_name = FONT_ALIASES[font_name]
-    if font_name.startswith("Dedris"):
-        font_name = "Ed"+font_name[1:]
-    # Todo: also replace "Drutsa-" and "Khamdris-" to "Ededris-"
-    if font_name.startswith("Sam") and len(font_name) == 4:
-        font_name = "Es"+font_name[1:]
-    base = get_base()
-    utfc_base = get_utfc_base()
-    if font_name not in base and font_name not in utfc_base:
-        if font_name not in stats["unhandled_fonts"]:
-            stats["unhandled_fonts"][font_name] = 0
-        stats["unhandled_fonts"][font_name] += 1
+    """
+    font_name can be the raw PDF font name, with or without subset prefix
+    """
+    font_name, table = resolve_font(font_name)
+    if table is None:
+        stats.unhandled_fonts[font_name] += 1
         return None
-    if font_name not in stats["handled_fonts"]:
-        stats["handled_fonts"][font_name] = 0
-    stats["handled_fonts"][font_name] += 1
-    res = ''
-    for char in s:  
-        res += _convert_char(char, font_name, stats)
-    return res
\ No newline at end of file
+    stats.handled_fonts[font_name] += 1
+    s = s.replace("\u00a0", " ")
+    if table.sequences is None:
+        s = _translate(s, table, stats)
+    else:
+        s = _convert_sequences(s, table, stats)
+    return s
+
+def _convert_sequences(s, table, stats):
+    """
+    longest match of the glyph sequences of the table, in one pass over s,
+    the strings in between are converted glyph by glyph
+    """
+    trie, starts = table.sequence_trie()
+    parts = []
+    # end of the last sequence, and where to look for the next one
+    done = i = 0
+    n = len(s)
+    while True:
+        m = starts.search(s, i)
+        if m is None:
+            break
+        start = i = m.start()
+        node = trie
+        match = None
+        while i < n:
+            node = node.get(s[i])
+            if node is None:
+                break
+            i += 1
+            if "" in node:
+                match = i, node[""]
+        if match is None:
+            i = start + 1
+            continue
+        parts.append(_translate(s[done:start], table, stats))
+        done, value = match
+        parts.append(value)
+        i = done
+    parts.append(_translate(s[done:], table, stats))
+    return "".join(parts)
+
+# Legacy fonts have separate glyphs for the vowels and subjoined letters,
+# that the tables convert in glyph order: a vowel can come before the
+# subjoined letter it's drawn over or be repeated. Rank of the marks in a
+# stack, in Unicode order:
+#   0: subjoined consonants
+#   1: a-chung
+#   2: vowel signs
+#   3: anusvara, candrabindu
+#   4: halanta and the signs over the candrabindu
+STACK_RANKS = {}
+for cp in list(range(0x0F8D, 0x0F98)) + list(range(0x0F99, 0x0FBD)):
+    STACK_RANKS[chr(cp)] = 0
+STACK_RANKS["\u0f71"] = 1
+for cp in list(range(0x0F72, 0x0F7E)) + [0x0F80, 0x0F81]:
+    STACK_RANKS[chr(cp)] = 2
+for cp in [0x0F7E, 0x0F82, 0x0F83]:
+    STACK_RANKS[chr(cp)] = 3
+for cp in [0x0F84, 0x0F86, 0x0F87]:
+    STACK_RANKS[chr(cp)] = 4
+
+def _ranks_class(ranks):
+    return "[%s]" % "".join(c for c, rank in STACK_RANKS.items() if rank in ranks)
+
+# a sequence of two marks that is out of order or a repeated mark (other
+# than subjoined consonants), which are rare enough for a search of this
+# pattern to be the only cost on most strings
+# (the lookahead makes the search skip the other characters faster)
+STACK_ERROR_PATT = re.compile("(?=%s)(?:%s)" % (_ranks_class(range(1, 5)), "|".join(
+    [_ranks_class(range(rank+1, 5)) + _ranks_class([rank]) for rank in range(4)]
+    + ["(%s)\\1" % _ranks_class(range(1, 5))])))
+STACK_MARKS_PATT = re.compile(_ranks_class(range(5)) + "{2,}")
+
+def _reorder_marks(m):
+    res = []
+    prev = None
+    # sorted is stable, so subjoined consonants keep their order
+    for c in sorted(m.group(0), key=STACK_RANKS.__getitem__):
+        if c != prev or STACK_RANKS[c] == 0:
+            res.append(c)
+        prev = c
+    return "".join(res)
+
+def reorder_stacks(s):
+    """
+    puts the marks of each stack in Unicode order and removes the repeated
+    ones, in one pass, only on strings where the order is wrong
+    """
+    if STACK_ERROR_PATT.search(s) is None:
+        return s
+    return STACK_MARKS_PATT.sub(_reorder_marks, s)
@@ -0,0 +1,67 @@
+from pathlib import Path
+import argparse
+import json
+
+import char_converter
+from char_converter import new_stats, merge_stats
+from glyph_stream import GlyphStreamWriter, SPANS_MAGIC, map_glyph_stream, read_header, read_glyph_stream, convert_glyph_stream
+from sinks import NewlineCollapsingWriter
+
+# Converts glyph streams (see glyph_stream.py, for instance the files kept
+# in the --cache-dir folder of deduff_pdf.py) to Unicode text, without
+# pdfminer, so that a fixed table or DEBUGMODE can be applied to a whole
+# corpus in seconds.
+
+def glyph_stream_paths(inputs):
+    for input_path in inputs:
+        input_path = Path(input_path)
+        if input_path.is_dir():
+            yield from sorted(input_path.glob("*.glyphs"))
+        else:
+            yield input_path
+
+def convert_glyph_stream_file(path, output_folder, page_break_str="\n\n-- page {} --\n\n", stats=None, spans=False):
+    """
+    writes the text of a glyph stream file in output_folder, named after
+    the PDF it was recorded from, returns the path of the text file
+
+    with spans, the span stream is written next to the text (.spans)
+    """
+    if stats is None:
+        stats = new_stats()
+    buf = map_glyph_stream(path)
+    try:
+        source_name, _ = read_header(buf)
+        stem = Path(source_name).stem if source_name else Path(path).stem
+        txt_path = Path(output_folder) / (stem + ".txt")
+        with open(txt_path, "w") as f:
+            if not spans:
+                convert_glyph_stream(read_glyph_stream(buf), NewlineCollapsingWriter(f), stats, page_break_str)
+            else:
+                with open(txt_path.with_suffix(".spans"), "wb") as spans_f:
+                    spans_writer = GlyphStreamWriter(spans_f, source_name=source_name, magic=SPANS_MAGIC)
+                    convert_glyph_stream(read_glyph_stream(buf), NewlineCollapsingWriter(f), stats, page_break_str, spans_writer)
+    finally:
+        buf.close()
+    return txt_path
+
+if __name__ == "__main__":
+    argparser = argparse.ArgumentParser(description="convert glyph streams to Unicode text")
+    argparser.add_argument("inputs", nargs="+", help="glyph stream files or folders")
+    argparser.add_argument("-o", "--output-folder", default="output/")
+    argparser.add_argument("--debug", action="store_true", help="show unknown characters and table divergences in the output")
+    argparser.add_argument("--spans", action="store_true", help="also write the span streams (positions, fonts and converted text of the runs)")
+    argparser.add_argument("--reorder", action="store_true", help="put the vowels and marks of each stack in Unicode order")
+    args = argparser.parse_args()
+    char_converter.DEBUGMODE = args.debug
+    char_converter.REORDER = args.reorder
+    total_stats = new_stats()
+    for path in glyph_stream_paths(args.inputs):
+        stats = new_stats()
+        print(convert_glyph_stream_file(path, args.output_folder, stats=stats, spans=args.spans))
+        merge_stats(total_stats, stats)
+    total_stats = total_stats.to_dict()
+    print(json.dumps(total_stats))
+    for fontname in total_stats["unknown_characters"]:
+        for c in total_stats["unknown_characters"][fontname]:
+            print("%s,%d,??(%s)" % (fontname, ord(c), c))
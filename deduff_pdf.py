@@ -1,57 +1,631 @@
-from io import StringIO
-import re
+from io import StringIO, BytesIO
+import os
+import hashlib
+import logging
 from pathlib import Path
 import json
+import argparse
+import pickle
+import queue
+import shutil
+import signal
+import threading
+from collections import deque
+from multiprocessing import Pool, cpu_count
+from time import perf_counter
 
-from pdfminer_text_converter import DuffedTextConverter
+from pdfminer_text_converter import DuffedTextConverter, page_font_names
 from pdfminer.pdfdocument import PDFDocument
 from pdfminer.pdfinterp import PDFResourceManager, PDFPageInterpreter
 from pdfminer.pdfpage import PDFPage
 from pdfminer.pdfparser import PDFParser
 from pdfminer.layout import LAParams
+import char_converter
+from char_converter import new_stats, merge_stats
+from font_tables import get_compiled_tables, tables_version, font_versions
+from batch_manifest import Manifest, file_sha256, input_entry, options_key
+from glyph_stream import GlyphStreamWriter, SPANS_MAGIC, read_glyph_stream, map_glyph_stream, read_header, convert_glyph_stream, write_header
+from sinks import NewlineCollapsingWriter, NEWLINES_PATT
+from region_detection import detect_region
 
 # region is x, y, w, h as in https://iiif.io/api/image/3.0/#41-region
 REGION = [120,0,950,100000]
 
-def deduffed_txt_from_pdf(pdf_file_name, region=None, page_break_str="\n\n-- page {} --\n\n"):
-    stats = {
-        "unhandled_fonts": {},
-        "handled_fonts": {},
-        "unknown_characters": {},
-        "error_characters": 0,
-        "diffs_with_utfc": {}
-    }
-    output_string = StringIO()
-    with open(pdf_file_name, 'rb') as in_file:
-        parser = PDFParser(in_file)
-        doc = PDFDocument(parser)
-        rsrcmgr = PDFResourceManager()
-        device = DuffedTextConverter(rsrcmgr, output_string, stats, region = region, pbs = page_break_str)
-        interpreter = PDFPageInterpreter(rsrcmgr, device)
-        pnum = 1
-        for page in PDFPage.create_pages(doc):
-            #if pnum == 1:
-            #    pnum += 1
-            #    continue
-            #if pnum == 3:
-            #    break
-            interpreter.process_page(page)
-            pnum += 1
-    res = output_string.getvalue()
-    res = re.sub(r"\n\n+", "\n", res)
+def print_stats(stats):
+    timings = stats.timings
+    stats = stats.to_dict()
     print(json.dumps(stats))
+    if timings is not None:
+        print(json.dumps({"timings": timings.to_dict(pages=False)}))
     for fontname in stats["unknown_characters"]:
         for c in stats["unknown_characters"][fontname]:
             print("%s,%d,??(%s)" % (fontname, ord(c), c))
+
+def _pdf_pages(in_file, first=0, last=None):
+    """
+    yields (page index, page) for the pages first to last (excluded, None
+    for the end) of a PDF
+    """
+    doc = PDFDocument(PDFParser(in_file))
+    for pnum, page in enumerate(PDFPage.create_pages(doc)):
+        if pnum < first:
+            continue
+        if last is not None and pnum >= last:
+            break
+        yield pnum, page
+
+def _open_pdf(pdf):
+    """
+    pdf is a file name or the content of the PDF (bytes)
+    """
+    if isinstance(pdf, bytes):
+        return BytesIO(pdf)
+    return open(pdf, 'rb')
+
+def resolve_region(region, pdf):
+    """
+    the region detected in pdf (a file name or bytes) for "auto", else
+    region
+    """
+    if region != "auto":
+        return region
+    with _open_pdf(pdf) as in_file:
+        return detect_region(in_file)
+
+def _deduff_pages_to(task, outfp, stats, recorder=None, spans=None):
+    """
+    converts a page range of a PDF into outfp
+    """
+    pdf_file_name, first, last, converter_args = task[:4]
+    with _open_pdf(pdf_file_name) as in_file:
+        rsrcmgr = PDFResourceManager()
+        device = DuffedTextConverter(rsrcmgr, outfp, stats, pageno = first+1, recorder = recorder, spans = spans, **converter_args)
+        interpreter = PDFPageInterpreter(rsrcmgr, device)
+        for _, page in _pdf_pages(in_file, first, last):
+            device.process_page(interpreter, page)
+
+def _deduff_pages(task):
+    """
+    returns the raw text, the stats, the glyph stream and the span stream
+    records of a page range; the fifth element of the task is a dict
+    telling what to collect besides the text: record (the glyph stream,
+    else None), timings and spans (else None)
+    """
+    collect = task[4]
+    stats = new_stats(collect["timings"])
+    output_string = StringIO()
+    recorded = BytesIO() if collect["record"] else None
+    spans = BytesIO() if collect["spans"] else None
+    _deduff_pages_to(task, output_string, stats, None if recorded is None else GlyphStreamWriter(recorded, header=False), None if spans is None else GlyphStreamWriter(spans, header=False))
+    return output_string.getvalue(), stats, None if recorded is None else recorded.getvalue(), None if spans is None else spans.getvalue()
+
+def pdf_cache_key(pdf_file_name, converter_args):
+    """
+    sha256 of the PDF, followed by a short hash of the options changing
+    the glyph stream
+    """
+    options = json.dumps([converter_args.get("region"), converter_args.get("fast_layout"), converter_args.get("prescan")])
+    return file_sha256(pdf_file_name) + "-" + hashlib.sha256(options.encode()).hexdigest()[:8]
+
+def nb_pages_in_pdf(pdf_file_name):
+    with open(pdf_file_name, 'rb') as in_file:
+        return sum(1 for _ in _pdf_pages(in_file))
+
+def page_ranges(nb_pages, page_jobs):
+    # a few ranges per worker so that uneven pages don't leave workers idle
+    size = max(1, -(-nb_pages // (page_jobs * 4)))
+    return [(first, min(first + size, nb_pages)) for first in range(0, nb_pages, size)]
+
+def deduff_pdf_to_sink(pdf_file_name, outfp, region=None, page_break_str="\n\n-- page {} --\n\n", stats=None, page_jobs=1, fast_layout=False, prescan=None, cache_dir=None, timings=False, spans=None):
+    """
+    streams the converted text into outfp (any text sink) page by page,
+    runs of newlines are collapsed on the way
+
+    if stats is given, the stats are collected there instead of being printed
+
+    page_jobs > 1 splits the pages in ranges converted by that many worker
+    processes, each with its own PDFResourceManager and DuffedTextConverter
+
+    region is x, y, w, h (see REGION), or "auto" to detect the main text
+    block of the PDF on a few pages first, see region_detection.py
+
+    fast_layout skips pdfminer's layout analysis, see DuffedTextConverter
+
+    prescan ("plain" or "skip") looks at the fonts of each page before
+    interpreting it, pages without legacy fonts are then not converted or
+    skipped, see DuffedTextConverter.process_page
+
+    with cache_dir, the glyph stream of the PDF is kept in that folder,
+    keyed by PDF hash, and converting the same PDF again only replays it
+    through convert_string, without pdfminer
+
+    timings collects the time spent in each stage in stats.timings (see
+    timings.py), when stats is not given
+
+    spans is a binary file receiving the span stream of the PDF (positions,
+    fonts and converted text of the runs, see glyph_stream.py)
+
+    pdf_file_name can also be the content of the PDF (bytes) when there is
+    no cache_dir and page_jobs is 1
+    """
+    start = perf_counter()
+    report = stats is None
+    if stats is None:
+        stats = new_stats(timings)
+    sink = NewlineCollapsingWriter(outfp)
+    converter_args = {"region": region, "pbs": page_break_str, "fast_layout": fast_layout, "prescan": prescan}
+    cache_path = None
+    recorded = None
+    spans_writer = None
+    if spans is not None:
+        spans_writer = GlyphStreamWriter(spans, source_name="" if isinstance(pdf_file_name, bytes) else Path(pdf_file_name).name, magic=SPANS_MAGIC)
+    if cache_dir is not None:
+        cache_path = Path(cache_dir) / (pdf_cache_key(pdf_file_name, converter_args) + ".glyphs")
+        if cache_path.exists():
+            buf = map_glyph_stream(cache_path)
+            try:
+                read_header(buf)
+            except ValueError as e:
+                # glyph streams of older versions are just recorded again
+                logging.warning("%s: %s" % (cache_path, e))
+                buf.close()
+                buf = None
+            if buf is not None:
+                try:
+                    convert_glyph_stream(read_glyph_stream(buf), sink, stats, page_break_str, spans_writer)
+                finally:
+                    buf.close()
+                if stats.timings is not None:
+                    stats.timings.add_file(perf_counter() - start)
+                if report:
+                    print_stats(stats)
+                return stats
+        os.makedirs(cache_dir, exist_ok=True)
+        recorded = open(str(cache_path) + ".tmp", 'wb')
+        write_header(recorded, Path(pdf_file_name).name)
+    try:
+        # after the cache lookup, the detected region only depends on the PDF
+        converter_args["region"] = resolve_region(region, pdf_file_name)
+        if page_jobs == 1:
+            _deduff_pages_to((pdf_file_name, 0, None, converter_args), sink, stats, None if recorded is None else GlyphStreamWriter(recorded, header=False), spans_writer)
+        else:
+            collect = {"record": recorded is not None, "timings": stats.timings is not None, "spans": spans is not None}
+            tasks = [(pdf_file_name, first, last, converter_args, collect) for first, last in page_ranges(nb_pages_in_pdf(pdf_file_name), page_jobs or cpu_count())]
+            # see deduff_folder
+            get_compiled_tables()
+            with Pool(page_jobs, initializer=_init_worker, initargs=(char_converter.REORDER,)) as pool:
+                for part, part_stats, part_glyphs, part_spans in pool.imap(_deduff_pages, tasks):
+                    sink.write(part)
+                    merge_stats(stats, part_stats)
+                    if recorded is not None:
+                        recorded.write(part_glyphs)
+                    if spans is not None:
+                        spans.write(part_spans)
+    finally:
+        if recorded is not None:
+            recorded.close()
+    if recorded is not None:
+        os.replace(str(cache_path) + ".tmp", cache_path)
+    if stats.timings is not None:
+        stats.timings.add_file(perf_counter() - start)
+    if report:
+        print_stats(stats)
+    return stats
+
+def deduffed_txt_from_pdf(pdf_file_name, region=None, page_break_str="\n\n-- page {} --\n\n", stats=None, page_jobs=1, fast_layout=False, prescan=None, cache_dir=None, timings=False):
+    """
+    returns the converted text of a PDF, see deduff_pdf_to_sink
+    """
+    output_string = StringIO()
+    deduff_pdf_to_sink(pdf_file_name, output_string, region, page_break_str, stats, page_jobs, fast_layout, prescan, cache_dir, timings)
+    return output_string.getvalue()
+
+def deduffed_pages_from_pdf(pdf_file_name, region=None, fast_layout=False, prescan=None, first=0, last=None):
+    """
+    yields (page number, text, page stats) for each page as soon as it is
+    converted, without page break markers, for the pages first to last
+    (excluded, None for the end)
+    """
+    region = resolve_region(region, pdf_file_name)
+    with open(pdf_file_name, 'rb') as in_file:
+        rsrcmgr = PDFResourceManager()
+        output_string = StringIO()
+        device = DuffedTextConverter(rsrcmgr, output_string, None, pageno = first+1, region = region, pbs = "", fast_layout = fast_layout, prescan = prescan)
+        interpreter = PDFPageInterpreter(rsrcmgr, device)
+        for pnum, page in _pdf_pages(in_file, first, last):
+            device.stats = new_stats()
+            device.process_page(interpreter, page)
+            text = output_string.getvalue()
+            output_string.seek(0)
+            output_string.truncate()
+            yield pnum+1, NEWLINES_PATT.sub("\n", text), device.stats
+
+def font_inventory(pdf_file_name):
+    """
+    returns normalized font name -> number of pages using it, from the page
+    resources only
+    """
+    res = {}
+    with open(pdf_file_name, 'rb') as in_file:
+        for _, page in _pdf_pages(in_file):
+            for font_name in page_font_names(page):
+                res[font_name] = res.get(font_name, 0) + 1
     return res
 
-def deduff_folder(input_folder="input/", output_folder="output/", region=None, page_break_str="\n\n-- page {} --\n\n"):
-    paths = Path(input_folder).glob("*.pdf")
-    for path in paths:
-        txt = deduffed_txt_from_pdf(path, region, page_break_str)
-        txt_path = Path(output_folder) / Path(str(path.stem) + ".txt")
-        print(txt_path)
-        with open(txt_path, "w") as f:
-            f.write(txt)
-# [0,50,1000000,500]
-deduff_folder("input/", "output/", None, "\n\n-- page {} --\n\n")
\ No newline at end of file
+def _init_worker(reorder=False):
+    # open the table store once per worker instead of once per file, the
+    # table of each font is then loaded when a document first uses it (a
+    # no-op for forked workers, which inherit the store of the parent)
+    get_compiled_tables()
+    char_converter.REORDER = reorder
+
+class FileTimeout(BaseException):
+    # not an Exception, so that the except clauses of pdfminer let it through
+    pass
+
+def _raise_timeout(signum, frame):
+    raise FileTimeout()
+
+def _deduff_checkpointed(path, txt_path, options, stats, checkpoint_pages, checkpoint_dir):
+    """
+    converts path in ranges of checkpoint_pages pages, the text and stats
+    of each range are kept in checkpoint_dir until the whole file is done,
+    so that a new run only converts the missing ranges (the glyph stream
+    cache is not used)
+    """
+    start = perf_counter()
+    os.makedirs(checkpoint_dir, exist_ok=True)
+    converter_args = {"region": resolve_region(options["region"], path), "pbs": options["page_break_str"], "fast_layout": options["fast_layout"], "prescan": options["prescan"]}
+    nb_pages = nb_pages_in_pdf(path)
+    ranges = [(first, min(first + checkpoint_pages, nb_pages)) for first in range(0, nb_pages, checkpoint_pages)]
+    part_path = lambda first: Path(checkpoint_dir) / ("%06d.pickle" % first)
+    collect = {"record": False, "timings": stats.timings is not None, "spans": False}
+    tasks = [(path, first, last, converter_args, collect) for first, last in ranges if not part_path(first).exists()]
+    page_jobs = options["page_jobs"]
+    if page_jobs == 1 or len(tasks) < 2:
+        results = map(_deduff_pages, tasks)
+        pool = None
+    else:
+        pool = Pool(page_jobs, initializer=_init_worker, initargs=(char_converter.REORDER,))
+        results = pool.imap(_deduff_pages, tasks)
+    try:
+        for task, (part, part_stats, _, _) in zip(tasks, results):
+            with open(str(part_path(task[1])) + ".tmp", "wb") as f:
+                pickle.dump((part, part_stats), f)
+            os.replace(str(part_path(task[1])) + ".tmp", part_path(task[1]))
+    finally:
+        if pool is not None:
+            pool.terminate()
+            pool.join()
+    with open(str(txt_path) + ".tmp", "w") as f:
+        sink = NewlineCollapsingWriter(f)
+        for first, _ in ranges:
+            with open(part_path(first), "rb") as part_f:
+                part, part_stats = pickle.load(part_f)
+            sink.write(part)
+            merge_stats(stats, part_stats)
+    os.replace(str(txt_path) + ".tmp", txt_path)
+    shutil.rmtree(checkpoint_dir, ignore_errors=True)
+    if stats.timings is not None:
+        stats.timings.add_file(perf_counter() - start)
+
+def _run_batch_file(path, txt_path, batch, stats, convert, data=None):
+    """
+    runs convert() for a file of a batch, with the timeout of the batch,
+    returns the stats (None if the conversion failed) and the manifest
+    entry of the file; data is the content of the file if it was read
+    already
+    """
+    entry = input_entry(path)
+    entry.update(output=str(txt_path), options=batch["options"], tables=batch["tables"])
+    start = perf_counter()
+    timeout = batch["timeout"]
+    if timeout:
+        previous_handler = signal.signal(signal.SIGALRM, _raise_timeout)
+        signal.setitimer(signal.ITIMER_REAL, timeout)
+    try:
+        convert()
+        entry["status"] = "done"
+        entry["fonts"] = font_versions(sorted(set(stats.handled_fonts) | set(stats.unhandled_fonts)))
+    except FileTimeout:
+        entry.update(status="timeout", error="no result after %gs" % timeout)
+        stats = None
+    except Exception as e:
+        logging.exception("conversion of %s failed", path)
+        entry.update(status="error", error="%s: %s" % (type(e).__name__, e))
+        stats = None
+    finally:
+        if timeout:
+            signal.setitimer(signal.ITIMER_REAL, 0)
+            signal.signal(signal.SIGALRM, previous_handler)
+    entry["seconds"] = perf_counter() - start
+    try:
+        entry["sha256"] = file_sha256(path) if data is None else hashlib.sha256(data).hexdigest()
+    except OSError:
+        # the file could not be read, which is the error of the entry
+        pass
+    return stats, entry
+
+def _deduff_file(task):
+    """
+    returns the output path, the stats (None if the conversion failed) and
+    the manifest entry of the file (None without batch options)
+    """
+    path, txt_path, options = task[:3]
+    batch = task[3] if len(task) > 3 else None
+    stats = new_stats(options["timings"])
+    # the span stream is written next to the text
+    options = dict(options)
+    spans_path = Path(txt_path).with_suffix(".spans") if options.pop("spans") else None
+    txt_tmp = str(txt_path) + ".tmp"
+    spans_tmp = None if spans_path is None else str(spans_path) + ".tmp"
+    def deduff_to(txt_file_name, spans_file_name):
+        with open(txt_file_name, "w") as f:
+            if spans_path is None:
+                deduff_pdf_to_sink(path, f, stats=stats, **options)
+                return
+            with open(spans_file_name, "wb") as spans_f:
+                deduff_pdf_to_sink(path, f, stats=stats, spans=spans_f, **options)
+    if batch is None:
+        deduff_to(txt_path, spans_path)
+        return txt_path, stats, None
+    def convert():
+        if batch["checkpoint_pages"]:
+            _deduff_checkpointed(path, txt_path, options, stats, batch["checkpoint_pages"], batch["checkpoint_dir"])
+        else:
+            deduff_to(txt_tmp, spans_tmp)
+            if spans_path is not None:
+                os.replace(spans_tmp, spans_path)
+            os.replace(txt_tmp, txt_path)
+    stats, entry = _run_batch_file(path, txt_path, batch, stats, convert)
+    if stats is None:
+        for tmp_path in [txt_tmp, spans_tmp]:
+            if tmp_path is not None and os.path.exists(tmp_path):
+                os.remove(tmp_path)
+    return txt_path, stats, entry
+
+def _deduff_data(task):
+    """
+    like _deduff_file for the content of a file read by the pipeline,
+    returns the text instead of writing it: (output path, text, stats,
+    entry); data is None and read_error the exception if the file could
+    not be read, which then fails as a conversion error
+    """
+    path, txt_path, options, batch, data, read_error = task
+    stats = new_stats(options["timings"])
+    options = dict(options)
+    del options["spans"]
+    output_string = StringIO()
+    def convert():
+        if read_error is not None:
+            raise read_error
+        deduff_pdf_to_sink(data, output_string, stats=stats, **options)
+    entry = None
+    if batch is None:
+        convert()
+    else:
+        stats, entry = _run_batch_file(path, txt_path, batch, stats, convert, data)
+    return txt_path, output_string.getvalue() if stats is not None else None, stats, entry
+
+def _pipeline_results(tasks, jobs, reorder, prefetch, manifest):
+    """
+    converts the files of tasks in three stages: a thread reading the PDFs
+    ahead, the pool of workers converting them and a thread writing the
+    outputs (and recording the manifest entries), so that the storage
+    reads and writes overlap with the conversion. The queues between the
+    stages hold at most prefetch files, the reader waits when the workers
+    are behind and the workers when the writer is. Yields (output path,
+    stats, entry) in the order of tasks.
+    """
+    reader_queue = queue.Queue(prefetch)
+    writer_queue = queue.Queue(prefetch)
+    stop = threading.Event()
+    errors = []
+
+    def put(q, item):
+        # gives up when the pipeline is stopped early
+        while not stop.is_set():
+            try:
+                q.put(item, timeout=0.1)
+                return True
+            except queue.Full:
+                pass
+        return False
+
+    def read():
+        try:
+            for task in tasks:
+                # a file that cannot be read fails alone, as with the
+                # reads of _deduff_file
+                try:
+                    data, read_error = Path(task[0]).read_bytes(), None
+                except OSError as e:
+                    data, read_error = None, e
+                if not put(reader_queue, (task, data, read_error)):
+                    return
+        except BaseException as e:
+            errors.append(e)
+        put(reader_queue, None)
+
+    def write():
+        while True:
+            item = writer_queue.get()
+            if item is None:
+                return
+            txt_path, text, entry = item
+            try:
+                if text is not None:
+                    with open(str(txt_path) + ".tmp", "w") as f:
+                        f.write(text)
+                    os.replace(str(txt_path) + ".tmp", txt_path)
+                if entry is not None:
+                    manifest.record(entry)
+            except BaseException as e:
+                errors.append(e)
+                stop.set()
+                return
+
+    reader = threading.Thread(target=read, daemon=True)
+    writer = threading.Thread(target=write, daemon=True)
+    reader.start()
+    writer.start()
+    pool = Pool(jobs, initializer=_init_worker, initargs=(reorder,))
+    pending = deque()
+    try:
+        done_reading = False
+        while not done_reading or pending:
+            # keeps the workers busy, the results are taken in order
+            while not done_reading and len(pending) < jobs + prefetch:
+                item = reader_queue.get()
+                if item is None:
+                    done_reading = True
+                    break
+                task, data, read_error = item
+                batch = task[3] if len(task) > 3 else None
+                pending.append(pool.apply_async(_deduff_data, ((task[0], task[1], task[2], batch, data, read_error),)))
+            if errors:
+                raise errors[0]
+            if pending:
+                txt_path, text, stats, entry = pending.popleft().get()
+                if not put(writer_queue, (txt_path, text, entry)):
+                    raise errors[0]
+                yield txt_path, stats, entry
+        # the writer may have stopped on an error with the queue full
+        if not put(writer_queue, None):
+            raise errors[0]
+        writer.join()
+        if errors:
+            raise errors[0]
+    finally:
+        stop.set()
+        pool.terminate()
+        pool.join()
+
+def deduff_folder(input_folder="input/", output_folder="output/", region=None, page_break_str="\n\n-- page {} --\n\n", jobs=1, page_jobs=1, fast_layout=False, prescan=None, cache_dir=None, reorder=False, timings_file=None, manifest=None, timeout=None, checkpoint_pages=None, retry_failed=False, pipeline=False, prefetch=4, spans=False):
+    """
+    jobs is the number of worker processes (None for one per CPU), the
+    stats of all the files are merged and printed at the end
+
+    page_jobs is passed to deduffed_txt_from_pdf, only one of jobs and
+    page_jobs can be more than 1 (pool workers cannot have children)
+
+    reorder sets char_converter.REORDER in all the processes
+
+    with timings_file, the timings of each file (see timings.py) are
+    written there as JSON lines, followed by the total
+
+    with manifest (a file name, see batch_manifest.py), the files already
+    converted with the same content, options and tables of their fonts are
+    skipped, and each file is recorded there as soon as it is done. The following
+    options need a manifest:
+    - timeout: seconds after which the conversion of a file is abandoned
+      (recorded as failed, then skipped by the next runs unless
+      retry_failed);
+    - checkpoint_pages: files are converted in ranges of that many pages,
+      kept in output_folder/.checkpoints/ so that an interrupted file
+      resumes at its last range.
+    Failed files do not stop the run when there is a manifest.
+
+    pipeline reads the PDFs ahead in a thread and writes the outputs in
+    another one while jobs workers convert, with at most prefetch files
+    waiting between the stages, see _pipeline_results (not with page_jobs,
+    cache_dir or checkpoint_pages)
+
+    spans writes the span stream of each PDF (see glyph_stream.py) next to
+    its text, with the .spans extension (not with pipeline or
+    checkpoint_pages)
+    """
+    if jobs != 1 and page_jobs != 1:
+        raise ValueError("jobs and page_jobs cannot both be different from 1")
+    paths = sorted(Path(input_folder).glob("*.pdf"))
+    options = {"region": region, "page_break_str": page_break_str, "page_jobs": page_jobs, "fast_layout": fast_layout, "prescan": prescan, "cache_dir": cache_dir, "timings": timings_file is not None, "spans": spans}
+    if manifest is None and (timeout or checkpoint_pages):
+        raise ValueError("timeout and checkpoint_pages need a manifest")
+    if pipeline and (page_jobs != 1 or cache_dir is not None or checkpoint_pages):
+        raise ValueError("pipeline cannot be used with page_jobs, cache_dir or checkpoint_pages")
+    if spans and (pipeline or checkpoint_pages):
+        raise ValueError("spans cannot be used with pipeline or checkpoint_pages")
+    tasks = [(path, Path(output_folder) / Path(str(path.stem) + ".txt"), options) for path in paths]
+    total_stats = new_stats(timings_file is not None)
+    pool = None
+    # compiles the tables if needed and maps them before the workers are
+    # forked, so that they all share the same read-only mapping
+    get_compiled_tables()
+    if manifest is not None:
+        manifest = Manifest(manifest)
+        # only the options changing the output
+        key = options_key(dict(options, reorder=reorder, page_jobs=None, cache_dir=None, timings=None))
+        tables = tables_version()
+        up_to_date = 0
+        batch_tasks = []
+        for task in tasks:
+            path, txt_path = task[:2]
+            if manifest.is_up_to_date(path, txt_path, key, tables, retry_failed):
+                up_to_date += 1
+                continue
+            checkpoint_dir = Path(output_folder) / ".checkpoints" / ("%s-%s" % (path.stem, options_key([key, tables, input_entry(path)])))
+            batch = {"options": key, "tables": tables, "timeout": timeout, "checkpoint_pages": checkpoint_pages, "checkpoint_dir": str(checkpoint_dir)}
+            batch_tasks.append(task + (batch,))
+        tasks = batch_tasks
+        print("%d files up to date, %d to convert" % (up_to_date, len(tasks)))
+    timings_fp = open(timings_file, "w") if timings_file is not None else None
+    if pipeline:
+        results = _pipeline_results(tasks, jobs or cpu_count(), reorder, prefetch, manifest)
+    elif jobs == 1:
+        _init_worker(reorder)
+        results = map(_deduff_file, tasks)
+    else:
+        pool = Pool(jobs, initializer=_init_worker, initargs=(reorder,))
+        # imap keeps the order of the tasks so that the report is the same
+        # whatever the number of workers
+        results = pool.imap(_deduff_file, tasks, chunksize=1)
+    try:
+        for txt_path, stats, entry in results:
+            # in the pipeline, the writer records the entries
+            if entry is not None and not pipeline:
+                manifest.record(entry)
+            if stats is None:
+                print("%s: %s" % (txt_path, entry["error"]))
+                continue
+            print(txt_path)
+            if timings_fp is not None:
+                timings_fp.write(json.dumps(dict(file=str(txt_path), **stats.timings.to_dict())) + "\n")
+            merge_stats(total_stats, stats)
+        if timings_fp is not None:
+            timings_fp.write(json.dumps({"total": total_stats.timings.to_dict(pages=False)}) + "\n")
+    finally:
+        if pool is not None:
+            pool.close()
+            pool.join()
+        if timings_fp is not None:
+            timings_fp.close()
+        if manifest is not None:
+            manifest.close()
+    print_stats(total_stats)
+    return total_stats
+
+if __name__ == "__main__":
+    argparser = argparse.ArgumentParser(description="convert PDFs using legacy Tibetan fonts to Unicode text")
+    argparser.add_argument("input_folder", nargs="?", default="input/")
+    argparser.add_argument("output_folder", nargs="?", default="output/")
+    argparser.add_argument("-j", "--jobs", type=int, default=1, help="number of worker processes, 0 for one per CPU")
+    argparser.add_argument("--page-jobs", type=int, default=1, help="number of worker processes converting the pages of each file, 0 for one per CPU")
+    argparser.add_argument("--region", help="x,y,w,h of the text to convert on each page in PDF coordinates, or auto to detect it in each PDF")
+    argparser.add_argument("--fast-layout", action="store_true", help="skip pdfminer's layout analysis and only sort the characters in lines")
+    argparser.add_argument("--prescan", choices=["plain", "skip"], help="look at the fonts of each page first, pages without legacy fonts are not converted (plain) or skipped (skip)")
+    argparser.add_argument("--reorder", action="store_true", help="put the vowels and marks of each stack in Unicode order (see char_converter.reorder_stacks)")
+    argparser.add_argument("--timings", help="write the time spent in each stage of each file and page in this JSON lines file")
+    argparser.add_argument("--cache-dir", help="folder keeping the glyph streams of the PDFs, to convert them again without pdfminer")
+    argparser.add_argument("--manifest", help="JSON lines file recording the converted files, the files up to date are skipped")
+    argparser.add_argument("--timeout", type=float, help="seconds after which the conversion of a file is abandoned (needs --manifest)")
+    argparser.add_argument("--checkpoint-pages", type=int, help="convert the files in ranges of that many pages, an interrupted file resumes at its last range (needs --manifest)")
+    argparser.add_argument("--pipeline", action="store_true", help="read the PDFs ahead and write the outputs in separate threads while the workers convert")
+    argparser.add_argument("--prefetch", type=int, default=4, help="number of files waiting between the stages of the pipeline")
+    argparser.add_argument("--spans", action="store_true", help="also write the positions, fonts and converted text of the runs in a .spans file (see glyph_stream.py)")
+    argparser.add_argument("--retry-failed", action="store_true", help="convert again the files that failed or timed out in a previous run")
+    args = argparser.parse_args()
+    region = args.region
+    if region is not None and region != "auto":
+        region = [float(v) for v in region.split(",")]
+    # [0,50,1000000,500]
+    deduff_folder(args.input_folder, args.output_folder, region, "\n\n-- page {} --\n\n", jobs=args.jobs or None, page_jobs=args.page_jobs or None, fast_layout=args.fast_layout, prescan=args.prescan, cache_dir=args.cache_dir, reorder=args.reorder, timings_file=args.timings, manifest=args.manifest, timeout=args.timeout, checkpoint_pages=args.checkpoint_pages, retry_failed=args.retry_failed, pipeline=args.pipeline, prefetch=args.prefetch, spans=args.spans)
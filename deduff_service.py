@@ -0,0 +1,175 @@
+import argparse
+import json
+import logging
+import os
+import tempfile
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+from multiprocessing import Pool, cpu_count
+from urllib.parse import urlparse, parse_qs
+
+from char_converter import new_stats, merge_stats
+from deduff_pdf import _init_worker, deduffed_pages_from_pdf, nb_pages_in_pdf, page_ranges, resolve_region
+from font_tables import get_compiled_tables
+
+# Conversion service: a local HTTP server keeping pdfminer imported, the
+# tables mapped and a pool of worker processes ready, so that a request
+# only costs the conversion itself.
+#
+#   POST /convert?path=/some/file.pdf
+#   POST /convert with the PDF as body (Content-Type: application/pdf)
+#
+# Options in the query string: fast_layout=1, prescan=plain|skip and
+# region=x,y,w,h (or auto). The pages of the PDF are split across the
+# workers, the response is streamed as JSON lines, one {"page": n,
+# "text": ...} per page in order, then {"stats": ...}. GET /status gives the number of
+# workers and fonts.
+#
+# There is no authentication: bind to localhost (the default) or to a
+# private interface only.
+
+def _convert_pages(task):
+    """
+    returns [(page number, text, page stats)] for a page range, the text
+    of each page without page break markers
+    """
+    pdf_file_name, first, last, options = task
+    return list(deduffed_pages_from_pdf(pdf_file_name, first=first, last=last, **options))
+
+def request_options(query):
+    """
+    converter options from the query string of a request, raises
+    ValueError for invalid values
+    """
+    options = {}
+    if query.get("fast_layout", ["0"])[0] not in ("", "0"):
+        options["fast_layout"] = True
+    prescan = query.get("prescan", [None])[0]
+    if prescan is not None:
+        if prescan not in ("plain", "skip"):
+            raise ValueError("prescan must be plain or skip")
+        options["prescan"] = prescan
+    region = query.get("region", [None])[0]
+    if region == "auto":
+        options["region"] = region
+    elif region is not None:
+        region = [float(v) for v in region.split(",")]
+        if len(region) != 4:
+            raise ValueError("region must be x,y,w,h")
+        options["region"] = region
+    return options
+
+class ConversionHandler(BaseHTTPRequestHandler):
+    # chunked responses need HTTP/1.1
+    protocol_version = "HTTP/1.1"
+
+    def send_json(self, code, obj):
+        body = (json.dumps(obj) + "\n").encode("utf-8")
+        self.send_response(code)
+        self.send_header("Content-Type", "application/json")
+        self.send_header("Content-Length", str(len(body)))
+        self.end_headers()
+        self.wfile.write(body)
+
+    def write_chunk(self, obj):
+        data = (json.dumps(obj) + "\n").encode("utf-8")
+        self.wfile.write(b"%x\r\n%s\r\n" % (len(data), data))
+        self.wfile.flush()
+
+    def do_GET(self):
+        if urlparse(self.path).path != "/status":
+            self.send_json(404, {"error": "not found"})
+            return
+        self.send_json(200, {"jobs": self.server.jobs, "fonts": len(get_compiled_tables())})
+
+    def do_POST(self):
+        url = urlparse(self.path)
+        if url.path != "/convert":
+            self.send_json(404, {"error": "not found"})
+            return
+        query = parse_qs(url.query)
+        try:
+            options = request_options(query)
+        except ValueError as e:
+            self.send_json(400, {"error": str(e)})
+            return
+        length = int(self.headers.get("Content-Length") or 0)
+        if "path" in query:
+            pdf_file_name = query["path"][0]
+            if not os.path.isfile(pdf_file_name):
+                self.send_json(404, {"error": "no such file: %s" % pdf_file_name})
+                return
+            self.convert(pdf_file_name, options)
+            return
+        if length == 0:
+            self.send_json(400, {"error": "no path and no PDF in the body"})
+            return
+        # the workers read the PDF from a file
+        with tempfile.NamedTemporaryFile(suffix=".pdf") as f:
+            remaining = length
+            while remaining > 0:
+                chunk = self.rfile.read(min(remaining, 1 << 20))
+                if not chunk:
+                    break
+                f.write(chunk)
+                remaining -= len(chunk)
+            f.flush()
+            self.convert(f.name, options)
+
+    def convert(self, pdf_file_name, options):
+        try:
+            nb_pages = nb_pages_in_pdf(pdf_file_name)
+            if "region" in options:
+                # detected once for all the page ranges
+                options = dict(options, region=resolve_region(options["region"], pdf_file_name))
+        except Exception as e:
+            self.send_json(400, {"error": "cannot read the PDF: %s" % e})
+            return
+        self.send_response(200)
+        self.send_header("Content-Type", "application/x-ndjson")
+        self.send_header("Transfer-Encoding", "chunked")
+        self.end_headers()
+        stats = new_stats()
+        tasks = [(pdf_file_name, first, last, options) for first, last in page_ranges(nb_pages, self.server.jobs)]
+        try:
+            for pages in self.server.pool.imap(_convert_pages, tasks):
+                for pageno, text, page_stats in pages:
+                    self.write_chunk({"page": pageno, "text": text})
+                    merge_stats(stats, page_stats)
+            self.write_chunk({"stats": stats.to_dict()})
+        except Exception as e:
+            # the status is already sent, the error ends the stream
+            logging.exception("conversion of %s failed", pdf_file_name)
+            self.write_chunk({"error": str(e)})
+        self.wfile.write(b"0\r\n\r\n")
+
+class ConversionServer(ThreadingHTTPServer):
+    daemon_threads = True
+
+    def __init__(self, address, jobs=None, reorder=False):
+        super().__init__(address, ConversionHandler)
+        self.jobs = jobs or cpu_count()
+        # see deduff_folder
+        get_compiled_tables()
+        _init_worker(reorder)
+        self.pool = Pool(self.jobs, initializer=_init_worker, initargs=(reorder,))
+
+    def server_close(self):
+        super().server_close()
+        self.pool.terminate()
+        self.pool.join()
+
+if __name__ == "__main__":
+    argparser = argparse.ArgumentParser(description="local service converting PDFs using legacy Tibetan fonts to Unicode text")
+    argparser.add_argument("--host", default="127.0.0.1")
+    argparser.add_argument("--port", type=int, default=8765)
+    argparser.add_argument("-j", "--jobs", type=int, default=0, help="number of worker processes, 0 for one per CPU")
+    argparser.add_argument("--reorder", action="store_true", help="put the vowels and marks of each stack in Unicode order (see char_converter.reorder_stacks)")
+    args = argparser.parse_args()
+    server = ConversionServer((args.host, args.port), args.jobs or None, args.reorder)
+    print("listening on %s:%d with %d workers" % (args.host, args.port, server.jobs))
+    try:
+        server.serve_forever()
+    except KeyboardInterrupt:
+        pass
+    finally:
+        server.server_close()
@@ -314,6 +314,7 @@ font_list_udp = {
 	"Tibetan-ModernA": {"maxc": 255},
 }
 
-create_rtf(font_list_attu, "allchars-attu.rtf")
-create_rtf(font_list_udp, "allchars-udp.rtf")
+if __name__ == "__main__":
+	create_rtf(font_list_attu, "allchars-attu.rtf")
+	create_rtf(font_list_udp, "allchars-udp.rtf")
 
@@ -0,0 +1,601 @@
+import csv
+import hashlib
+import json
+import mmap
+import os
+import re
+import struct
+import logging
+
+# Compiled form of the font tables: for each font, flat arrays indexed by
+# code point slot, holding the result merged from all the sources, flags
+# and the values of the sources that diverge from the result.
+#
+# Slots 0-255 are the code points themselves, the (few) higher code points
+# found in the tables (cp1252 and Mac Roman punctuation, PUA) get the slots
+# after 255, shared by all fonts, so that all arrays stay short.
+
+ERROR_CHR = "༠༠༠༠"
+
+# in order of precedence: a character gets the value of the first source
+# that has one (other than ERROR_CHR). tiblegenc and UTFC are proper CSV,
+# the UDP and ATTU exports are "font,code point,value" lines with unescaped
+# quotes in the values.
+SOURCES = [
+    ("tiblegenc", "font-tables/tiblegenc.csv", "csv"),
+    ("utfc", "font-tables/utfc.csv", "csv"),
+    ("udp", "font-tables/udp.csv", "lines"),
+    ("attu", "font-tables/attu.csv", "lines"),
+]
+# mappings of sequences of glyphs, for the fonts where a glyph depends on
+# its neighbors: font, code points separated by spaces, str
+SEQUENCES_FILE = "font-tables/sequences.csv"
+COMPILED_FILE = "font-tables/compiled.bin"
+
+MAGIC = b"TLGT"
+FORMAT_VERSION = 5
+
+# flags
+F_KNOWN = 1
+# tiblegenc and UTFC diverge (the diffs_with_utfc stats)
+F_DIVERGENT = 2
+# no source has a value other than ERROR_CHR
+F_ERROR = 4
+
+FONT_ALIASES = {
+    "Dedris-syma": "Ededris-sym",
+    "Ededris-syma": "Ededris-sym",
+    "TibetanClassicSkt": "TibetanClassicSkt1",
+    "TibetanChogyalSkt": "TibetanChogyalSkt1",
+    "Ltibetan": "LTibetan",
+}
+
+# fonts that use the same encoding as Ededris
+EDEDRIS_PREFIXES = ["Dedris-", "Drutsa-", "Khamdris-"]
+
+COMPILED = None
+
+def normalize_font_name(font_name):
+    # remove the subset prefix (ex: ABCDEF+Dedris-a1)
+    font_name = font_name[font_name.find('+')+1:]
+    for prefix in EDEDRIS_PREFIXES:
+        if font_name.startswith(prefix):
+            font_name = "Ededris-"+font_name[len(prefix):]
+            break
+    if font_name in FONT_ALIASES:
+        font_name = FONT_ALIASES[font_name]
+    if font_name.startswith("Dedris"):
+        font_name = "Ed"+font_name[1:]
+    if font_name.startswith("Sam") and len(font_name) == 4:
+        font_name = "Es"+font_name[1:]
+    return font_name
+
+class _DropMissing(dict):
+    # characters not in a str.translate table are normally kept as is,
+    # unknown characters must be removed instead
+    def __missing__(self, key):
+        return ""
+
+class _MarkMissing(dict):
+    # debug mode: unknown characters are marked
+    def __missing__(self, key):
+        return "[[%s]]" % chr(key)
+
+class FontTable:
+    """
+    flags[slot] is 0 for unknown characters, out[slot] is the output in
+    normal mode, bit i of div[slot] is set when source i has a different
+    value, which is then values[i][slot].
+
+    sequences is None or glyph sequence -> str, for the sequences that are
+    converted together instead of glyph by glyph.
+    """
+    __slots__ = ("name", "flags", "div", "out", "values", "sources", "high_slots", "sequences", "trans", "plain", "debug_trans", "trie", "version")
+
+    def __init__(self, name, flags, div, out, values, sources, high_slots, sequences=None):
+        self.name = name
+        self.flags = flags
+        self.div = div
+        self.out = out
+        self.values = values
+        self.sources = sources
+        self.high_slots = high_slots
+        self.sequences = sequences or None
+        self.trans = None
+        self.plain = None
+        self.debug_trans = None
+        self.trie = None
+        # see table_version
+        self.version = None
+
+    def translate_tables(self):
+        """
+        returns (trans, plain), two str.translate tables: trans gives the
+        output in normal mode, plain removes the characters that need no
+        bookkeeping, so that what remains is the unknown, error and
+        divergent characters
+        """
+        if self.trans is None:
+            trans = _DropMissing()
+            plain = {}
+            for cp, slot in self.code_points():
+                f = self.flags[slot]
+                if f == 0:
+                    continue
+                trans[cp] = self.out[slot]
+                if f == F_KNOWN:
+                    plain[cp] = None
+            self.trans = trans
+            self.plain = plain
+        return self.trans, self.plain
+
+    def debug_translate_table(self):
+        """
+        str.translate table for debug mode, where unknown characters, errors
+        and divergences between the sources are marked
+        """
+        if self.debug_trans is None:
+            debug_trans = _MarkMissing()
+            for cp, slot in self.code_points():
+                if self.flags[slot] != 0:
+                    debug_trans[cp] = self.debug_string(cp, slot)
+            self.debug_trans = debug_trans
+        return self.debug_trans
+
+    def debug_string(self, cp, slot):
+        """
+        [[font,cp,out or utfc value or udp:value...]] for divergent
+        characters, the UTFC value is untagged as in the original format
+        """
+        if self.flags[slot] & F_ERROR:
+            return "[[ERR]]"
+        div = self.div[slot]
+        if not div:
+            return self.out[slot]
+        values = [self.out[slot]]
+        for i, source in enumerate(self.sources):
+            if div & (1 << i):
+                value = self.values[i][slot]
+                values.append(value if source == "utfc" else "%s:%s" % (source, value))
+        return "[[%s,%d,%s]]" % (self.name, cp, " or ".join(values))
+
+    def sequence_trie(self):
+        """
+        returns (trie, starts): trie is a dict of dicts, glyph -> node of the
+        sequences continuing with that glyph, the str of a sequence being
+        under the key "" of its last node; starts is a regex of the first
+        glyphs of the sequences, to skip to the places where one can start
+        """
+        if self.trie is None:
+            trie = {}
+            for sequence, value in self.sequences.items():
+                node = trie
+                for c in sequence:
+                    node = node.setdefault(c, {})
+                node[""] = value
+            starts = re.compile("[%s]" % "".join(re.escape(c) for c in trie))
+            self.trie = (trie, starts)
+        return self.trie
+
+    def slot(self, cp):
+        if cp < 256:
+            return cp
+        return self.high_slots.get(cp, -1)
+
+    def code_points(self):
+        """
+        yields (cp, slot) for all the slots of the table
+        """
+        for cp in range(256):
+            yield cp, cp
+        for cp, slot in self.high_slots.items():
+            yield cp, slot
+
+def read_csv_table(filename):
+    """
+    returns font_name -> {code point: str}
+    """
+    base = {}
+    with open(filename, newline='', encoding='utf-8-sig') as csvfile:
+        reader = csv.reader(csvfile, quotechar='"')
+        for row in reader:
+            if len(row) < 3:
+                continue
+            if row[0] not in base:
+                base[row[0]] = {}
+            base[row[0]][int(row[1])] = row[2]
+    return base
+
+def read_lines_table(filename):
+    """
+    same as read_csv_table, for files where the value is the rest of the line
+    """
+    base = {}
+    with open(filename, encoding='utf-8-sig') as f:
+        for line in f:
+            row = line.rstrip("\n").split(",", 2)
+            if len(row) < 3:
+                continue
+            if row[0] not in base:
+                base[row[0]] = {}
+            base[row[0]][int(row[1])] = row[2]
+    return base
+
+def read_source_table(source):
+    """
+    returns normalized font name -> {code point: str}
+    """
+    _, filename, fmt = source
+    base = read_csv_table(filename) if fmt == "csv" else read_lines_table(filename)
+    return normalize_font_names(base)
+
+def normalize_font_names(base):
+    """
+    returns the table with normalized font names
+    """
+    # some tables use un-normalized names (Dedris-a, Sama, etc.), sometimes
+    # along with the normalized one: the code points of all the names are
+    # merged, the normalized one wins on conflicts
+    res = {}
+    for font_name, ft in base.items():
+        normalized = normalize_font_name(font_name)
+        merged = res.setdefault(normalized, {})
+        if normalized == font_name:
+            merged.update(ft)
+        else:
+            for cp, value in ft.items():
+                merged.setdefault(cp, value)
+    return res
+
+def read_sequences(filename=SEQUENCES_FILE):
+    """
+    returns normalized font name -> {glyph sequence: str}
+    """
+    base = {}
+    with open(filename, newline='', encoding='utf-8-sig') as csvfile:
+        for row in csv.reader(csvfile, quotechar='"'):
+            if len(row) < 3 or row[0].startswith("#"):
+                continue
+            font_name = normalize_font_name(row[0])
+            if font_name not in base:
+                base[font_name] = {}
+            # convert_string reads no-break spaces as spaces before matching
+            sequence = "".join(chr(int(cp)) for cp in row[1].split()).replace("\u00a0", " ")
+            base[font_name][sequence] = row[2]
+    return base
+
+def compile_tables(sources=SOURCES, bases=None, sequences_file=SEQUENCES_FILE):
+    """
+    bases can give the table of a source (source name -> font name ->
+    {code point: str}) instead of reading its file
+    """
+    sequences = read_sequences(sequences_file)
+    given = bases or {}
+    bases = []
+    for source in sources:
+        if source[0] in given:
+            bases.append(normalize_font_names(given[source[0]]))
+        else:
+            bases.append(read_source_table(source))
+    source_names = [source[0] for source in sources]
+    high_cps = set()
+    for b in bases:
+        for ft in b.values():
+            high_cps.update(cp for cp in ft if cp > 255)
+    high_slots = {}
+    for i, cp in enumerate(sorted(high_cps)):
+        high_slots[cp] = 256 + i
+    nb_slots = 256 + len(high_slots)
+    font_names = set()
+    for b in bases:
+        font_names.update(b)
+    tables = {}
+    for font_name in sorted(font_names):
+        fts = [b.get(font_name, {}) for b in bases]
+        flags = bytearray(nb_slots)
+        div = bytearray(nb_slots)
+        out = [""] * nb_slots
+        values = [[""] * nb_slots for _ in sources]
+        cps = set()
+        for ft in fts:
+            cps.update(ft)
+        for cp in cps:
+            slot = cp if cp < 256 else high_slots[cp]
+            vals = [ft.get(cp) for ft in fts]
+            res = next((v for v in vals if v is not None and v != ERROR_CHR), None)
+            f = F_KNOWN
+            if res is None:
+                f |= F_ERROR
+                res = ""
+            if len(vals) > 1 and vals[0] is not None and vals[1] is not None and vals[0] != vals[1]:
+                f |= F_DIVERGENT
+            d = 0
+            if not f & F_ERROR:
+                for i, v in enumerate(vals):
+                    if v is not None and v != res and v != ERROR_CHR:
+                        d |= 1 << i
+                        values[i][slot] = v
+            flags[slot] = f
+            div[slot] = d
+            out[slot] = res
+        tables[font_name] = FontTable(font_name, bytes(flags), bytes(div), out, values, source_names, high_slots, sequences.get(font_name))
+    return tables
+
+# File format (little endian):
+#   magic, uint16 version, uint16 number of fonts, uint16 number of high slots
+#   uint8 number of sources, for each: uint8 name length, name (utf-8)
+#   uint32 code point of each high slot
+#   index, for each font:
+#     uint16 name length, name (utf-8), uint32 offset, uint32 pool length
+#   for each font, at its offset:
+#     flags, then divergence bitmasks (one byte per slot each)
+#     pool: utf-8 of the out strings, the values of each source, then the
+#     glyph sequences, each followed by its str, separated by \0
+# The index lets TableStore read the table of a font only when it's used.
+
+def _common_header(sources, high_cps):
+    header = struct.pack("<B", len(sources))
+    for source in sources:
+        source = source.encode("utf-8")
+        header += struct.pack("<B", len(source)) + source
+    return header + struct.pack("<%dI" % len(high_cps), *high_cps)
+
+def _table_blobs(table):
+    """
+    the blobs of a table in the compiled file: flags, div, the lengths of
+    the pools then the pools
+    """
+    # the strings are in separate pools (out, the values of each source,
+    # the sequences) so that the values are only decoded in debug mode
+    seqs = []
+    if table.sequences:
+        for sequence, value in table.sequences.items():
+            seqs += [sequence, value]
+    pools = [table.out] + list(table.values) + [seqs]
+    pools = [("\0".join(strs)).encode("utf-8") for strs in pools]
+    lengths = struct.pack("<%dI" % len(pools), *[len(pool) for pool in pools])
+    return [bytes(table.flags), bytes(table.div), lengths] + pools
+
+def table_version(table):
+    """
+    short hash of the content of a font table: for each code point with a
+    value, its flags, output and the divergent values of the sources, and
+    the sequences. It changes when a source edit changes the output of the
+    font, in normal or debug mode, and only then (the slots shared by all
+    fonts are left out, so a new code point in a font does not change the
+    version of the others)
+    """
+    if table.version is None:
+        rows = []
+        for cp, slot in sorted(table.code_points()):
+            f = table.flags[slot]
+            if f == 0:
+                continue
+            div = table.div[slot]
+            values = [[source, table.values[i][slot]] for i, source in enumerate(table.sources) if div & (1 << i)]
+            rows.append([cp, f, table.out[slot], values])
+        sequences = sorted((table.sequences or {}).items())
+        content = json.dumps([rows, sequences], ensure_ascii=False)
+        table.version = hashlib.sha256(content.encode("utf-8")).hexdigest()[:16]
+    return table.version
+
+def save_compiled_tables(tables, filename=COMPILED_FILE):
+    first = next(iter(tables.values()), None)
+    high_slots = first.high_slots if first is not None else {}
+    sources = first.sources if first is not None else []
+    high_cps = sorted(high_slots, key=high_slots.get)
+    header = MAGIC + struct.pack("<HHH", FORMAT_VERSION, len(tables), len(high_cps))
+    header += _common_header(sources, high_cps)
+    names = [font_name.encode("utf-8") for font_name in tables]
+    offset = len(header) + sum(2 + len(name) + 8 for name in names)
+    index = b""
+    blobs = []
+    for name, table in zip(names, tables.values()):
+        table_blobs = _table_blobs(table)
+        data_len = sum(len(blob) for blob in table_blobs[2:])
+        index += struct.pack("<H", len(name)) + name + struct.pack("<II", offset, data_len)
+        blobs += table_blobs
+        offset += len(table.flags) + len(table.div) + data_len
+    with open(filename + ".tmp", "wb") as f:
+        f.write(header)
+        f.write(index)
+        for blob in blobs:
+            f.write(blob)
+    os.replace(filename + ".tmp", filename)
+
+class _PoolValues:
+    """
+    the values of each source of a table, decoded from the mapped file the
+    first time they are used (only debug mode needs them)
+    """
+    def __init__(self, buf, pools):
+        self.buf = buf
+        self.pools = pools
+        self.values = [None] * len(pools)
+
+    def __len__(self):
+        return len(self.pools)
+
+    def __getitem__(self, i):
+        values = self.values[i]
+        if values is None:
+            start, end = self.pools[i]
+            values = self.values[i] = str(self.buf[start:end], "utf-8").split("\0")
+        return values
+
+class TableStore:
+    """
+    the tables of a compiled file, the table of each font is decoded the
+    first time it is requested
+
+    the file is mapped read-only: the flags and divergence arrays are views
+    of the mapping, so all the worker processes share the same pages of the
+    page cache, and only the strings a process actually uses are decoded in
+    it (out, and the values of the sources in debug mode)
+    """
+    def __init__(self, filename=COMPILED_FILE):
+        self.filename = filename
+        self.tables = {}
+        with open(filename, "rb") as f:
+            self.mmap = mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)
+        self.buf = memoryview(self.mmap)
+        buf = self.buf
+        if bytes(buf[:4]) != MAGIC:
+            raise ValueError("%s is not a compiled font table file" % filename)
+        version, nb_fonts, nb_high = struct.unpack_from("<HHH", buf, 4)
+        if version != FORMAT_VERSION:
+            raise ValueError("%s has format version %d, expected %d" % (filename, version, FORMAT_VERSION))
+        pos = 10
+        nb_sources, = struct.unpack_from("<B", buf, pos)
+        pos += 1
+        self.sources = []
+        for _ in range(nb_sources):
+            length, = struct.unpack_from("<B", buf, pos)
+            self.sources.append(str(buf[pos+1:pos+1+length], "utf-8"))
+            pos += 1 + length
+        high_cps = struct.unpack_from("<%dI" % nb_high, buf, pos)
+        pos += 4 * nb_high
+        self.high_slots = {cp: 256 + i for i, cp in enumerate(high_cps)}
+        self.nb_slots = 256 + nb_high
+        self.index = {}
+        for _ in range(nb_fonts):
+            name_len, = struct.unpack_from("<H", buf, pos)
+            font_name = str(buf[pos+2:pos+2+name_len], "utf-8")
+            pos += 2 + name_len
+            self.index[font_name] = struct.unpack_from("<II", buf, pos)
+            pos += 8
+
+    def _load(self, font_name):
+        offset, _ = self.index[font_name]
+        nb_slots = self.nb_slots
+        buf = self.buf
+        flags = buf[offset:offset+nb_slots]
+        div = buf[offset+nb_slots:offset+2*nb_slots]
+        nb_pools = len(self.sources) + 2
+        pos = offset + 2*nb_slots
+        lengths = struct.unpack_from("<%dI" % nb_pools, buf, pos)
+        pos += 4 * nb_pools
+        pools = []
+        for length in lengths:
+            pools.append((pos, pos + length))
+            pos += length
+        out = str(buf[pools[0][0]:pools[0][1]], "utf-8").split("\0")
+        start, end = pools[-1]
+        seqs = str(buf[start:end], "utf-8").split("\0") if end > start else []
+        sequences = dict(zip(seqs[::2], seqs[1::2]))
+        values = _PoolValues(buf, pools[1:-1])
+        return FontTable(font_name, flags, div, out, values, self.sources, self.high_slots, sequences)
+
+    def get(self, font_name, default=None):
+        table = self.tables.get(font_name)
+        if table is None:
+            if font_name not in self.index:
+                return default
+            table = self._load(font_name)
+            self.tables[font_name] = table
+        return table
+
+    def __getitem__(self, font_name):
+        table = self.get(font_name)
+        if table is None:
+            raise KeyError(font_name)
+        return table
+
+    def __contains__(self, font_name):
+        return font_name in self.index
+
+    def __iter__(self):
+        return iter(self.index)
+
+    def __len__(self):
+        return len(self.index)
+
+def load_compiled_tables(filename=COMPILED_FILE):
+    """
+    returns all the tables of a compiled file
+    """
+    store = TableStore(filename)
+    return {font_name: store[font_name] for font_name in store}
+
+def is_up_to_date(filename=COMPILED_FILE, sources=SOURCES, sequences_file=SEQUENCES_FILE):
+    try:
+        mtime = os.path.getmtime(filename)
+    except OSError:
+        return False
+    return all(os.path.getmtime(path) <= mtime for path in [source[1] for source in sources] + [sequences_file])
+
+def get_compiled_tables():
+    """
+    returns font name -> FontTable, the tables are loaded lazily from the
+    compiled file, which is compiled first if needed
+    """
+    global COMPILED
+    if COMPILED is not None:
+        return COMPILED
+    if is_up_to_date():
+        try:
+            COMPILED = TableStore()
+            return COMPILED
+        except ValueError as e:
+            logging.warning("%s, recompiling" % e)
+    tables = compile_tables()
+    try:
+        save_compiled_tables(tables)
+        COMPILED = TableStore()
+    except OSError as e:
+        logging.warning("cannot save %s: %s" % (COMPILED_FILE, e))
+        COMPILED = tables
+    return COMPILED
+
+def tables_version():
+    """
+    short hash of the compiled tables, which changes with any edit of the
+    sources (or of the compiler), for the outputs to record what they were
+    converted with
+    """
+    tables = get_compiled_tables()
+    if isinstance(tables, TableStore):
+        return hashlib.sha256(tables.buf).hexdigest()[:16]
+    # the compiled file could not be saved: hash what it is compiled from
+    h = hashlib.sha256(b"%d" % FORMAT_VERSION)
+    for path in [source[1] for source in SOURCES] + [SEQUENCES_FILE]:
+        with open(path, "rb") as f:
+            h.update(f.read())
+    return h.hexdigest()[:16]
+
+def font_versions(font_names):
+    """
+    font name -> version of its table (None for fonts without table)
+    """
+    tables = get_compiled_tables()
+    res = {}
+    for font_name in font_names:
+        table = tables.get(font_name)
+        res[font_name] = None if table is None else table_version(table)
+    return res
+
+def check_sequences(tables):
+    """
+    returns [(font name, sequence, problem)] for the sequences that can
+    never match a glyph of the font (unknown glyphs) or that are useless
+    (the glyph by glyph output is already their str)
+    """
+    res = []
+    for font_name in tables:
+        table = tables[font_name]
+        if table.sequences is None:
+            continue
+        for sequence, value in table.sequences.items():
+            slots = [table.slot(ord(c)) for c in sequence]
+            unknown = [c for c, slot in zip(sequence, slots) if slot < 0 or table.flags[slot] == 0]
+            if unknown:
+                res.append((font_name, sequence, "unknown glyphs %s" % " ".join(str(ord(c)) for c in unknown)))
+            elif "".join(table.out[slot] for slot in slots) == value:
+                res.append((font_name, sequence, "same output glyph by glyph"))
+    return res
+
+if __name__ == "__main__":
+    tables = compile_tables()
+    save_compiled_tables(tables)
+    for font_name, sequence, problem in check_sequences(tables):
+        logging.warning("sequence %s of %s: %s" % (" ".join(str(ord(c)) for c in sequence), font_name, problem))
@@ -0,0 +1,147 @@
+import mmap
+import struct
+import char_converter
+from char_converter import convert_string, resolve_font, reorder_stacks
+
+# A glyph stream is what DuffedTextConverter sees of a PDF before the
+# character conversion: page breaks, runs of characters in one font (raw
+# font name, raw text, bounding box) and the text written as is (newlines,
+# text in fonts without table). Converting it again with convert_string
+# gives the same output as the initial conversion, without pdfminer.
+#
+# File format (little endian), a header then a list of records:
+#   header: magic, uint16 version, uint16 length, source file name (utf-8)
+#   P: uint32 page number
+#   F: uint16 font id, uint16 length, font name (utf-8)
+#   R: uint16 font id, 4 float32 bbox (x0, y0, x1, y1), uint32 length, text (utf-8)
+#   T: uint32 length, text (utf-8)
+# Font ids are defined by an F record before their first use, a new F
+# record for an id replaces the previous one, so that glyph streams
+# recorded separately (for page ranges) can be concatenated.
+#
+# All the records can be read in place, so glyph streams are read through
+# mmap (see map_glyph_stream) and never loaded in memory as a whole.
+#
+# A span stream (.spans files, for positional output) has the same format
+# with SPANS_MAGIC, but its runs hold the resolved font name and the
+# converted text, and it has no T records: page, PDF bbox (the coordinate
+# space of region), font and Unicode text of each run.
+
+MAGIC = b"TLGS"
+SPANS_MAGIC = b"TLSP"
+VERSION = 2
+
+PAGE = b"P"
+FONT = b"F"
+RUN = b"R"
+TEXT = b"T"
+
+class GlyphStreamWriter:
+    def __init__(self, fp, header=True, source_name="", magic=MAGIC):
+        self.fp = fp
+        self.font_ids = {}
+        if header:
+            write_header(fp, source_name, magic)
+
+    def page(self, pageno):
+        self.fp.write(PAGE + struct.pack("<I", pageno))
+
+    def run(self, fontname, text, bbox):
+        font_id = self.font_ids.get(fontname)
+        if font_id is None:
+            font_id = len(self.font_ids)
+            self.font_ids[fontname] = font_id
+            name = fontname.encode("utf-8")
+            self.fp.write(FONT + struct.pack("<HH", font_id, len(name)) + name)
+        text = text.encode("utf-8")
+        self.fp.write(RUN + struct.pack("<H4fI", font_id, *bbox, len(text)) + text)
+
+    def text(self, text):
+        text = text.encode("utf-8")
+        self.fp.write(TEXT + struct.pack("<I", len(text)) + text)
+
+def write_header(fp, source_name="", magic=MAGIC):
+    name = source_name.encode("utf-8")
+    fp.write(magic + struct.pack("<HH", VERSION, len(name)) + name)
+
+def read_header(buf, magic=MAGIC):
+    """
+    returns (source file name, position of the first record)
+    """
+    if buf[:4] != magic:
+        raise ValueError("not a glyph stream" if magic == MAGIC else "not a span stream")
+    version, length = struct.unpack_from("<HH", buf, 4)
+    if version != VERSION:
+        raise ValueError("glyph stream version %d, expected %d" % (version, VERSION))
+    return str(buf[8:8+length], "utf-8"), 8+length
+
+def map_glyph_stream(filename):
+    """
+    read-only mmap of a glyph stream file, to be closed by the caller
+    """
+    with open(filename, "rb") as f:
+        return mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)
+
+def read_glyph_stream(buf, magic=MAGIC):
+    """
+    yields (PAGE, page number), (RUN, font name, text, bbox) and (TEXT, text)
+    from a glyph stream (or a span stream) in a buffer (bytes or mmap)
+    """
+    _, pos = read_header(buf, magic)
+    unpack_from = struct.unpack_from
+    end = len(buf)
+    fonts = {}
+    while pos < end:
+        kind = buf[pos:pos+1]
+        pos += 1
+        if kind == RUN:
+            font_id, x0, y0, x1, y1, length = unpack_from("<H4fI", buf, pos)
+            pos += 22
+            yield RUN, fonts[font_id], str(buf[pos:pos+length], "utf-8"), (x0, y0, x1, y1)
+            pos += length
+        elif kind == TEXT:
+            length, = unpack_from("<I", buf, pos)
+            pos += 4
+            yield TEXT, str(buf[pos:pos+length], "utf-8")
+            pos += length
+        elif kind == PAGE:
+            yield PAGE, unpack_from("<I", buf, pos)[0]
+            pos += 4
+        elif kind == FONT:
+            font_id, length = unpack_from("<HH", buf, pos)
+            pos += 4
+            fonts[font_id] = str(buf[pos:pos+length], "utf-8")
+            pos += length
+        else:
+            raise ValueError("invalid glyph stream record %r at %d" % (kind, pos-1))
+
+def convert_glyph_stream(events, outfp, stats, pbs="\n\n-- page {} --\n\n", spans=None):
+    """
+    writes the converted text of a glyph stream into outfp, page by page,
+    and the span stream to spans (a GlyphStreamWriter) if given
+    """
+    def write(parts):
+        text = "".join(parts)
+        # as DuffedTextConverter.write_page
+        if char_converter.REORDER:
+            text = reorder_stacks(text)
+        outfp.write(text)
+    parts = []
+    for event in events:
+        kind = event[0]
+        if kind == RUN:
+            ctext = convert_string(event[2], event[1], stats)
+            ctext = event[2] if ctext is None else ctext
+            parts.append(ctext)
+            if spans is not None:
+                spans.run(resolve_font(event[1])[0], ctext, event[3])
+        elif kind == TEXT:
+            parts.append(event[1])
+        else:
+            if spans is not None:
+                spans.page(event[1])
+            if parts:
+                write(parts)
+            parts = [pbs.format(event[1])]
+    if parts:
+        write(parts)
@@ -1,3 +1,12 @@
+import argparse
+import os
+import sys
+import unicodedata
+
+REPO_DIR = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+sys.path.insert(0, REPO_DIR)
+import font_tables
+
 # These two tables are an index of character (not glyph) encoding, to have other tables written simply.
 # The first is for the fonts Ededris, Dedris and TibetanMachineWeb
 
@@ -406,22 +415,77 @@ ltibUniTab = {' ':" ", '!':"།", '#':"ི", '$':"ུ", '%':"ུ", '&':"ུ", '\
 
 ALL_FONTS["LTibetan"] = {"dt": ltibUniTab}
 
-for fname, finfo in ALL_FONTS.items():
-    if "dt" in finfo:
-        for c, r in finfo["dt"].items():
-            print(fname+","+str(ord(c))+","+r)
-        continue
-    lent = len(finfo["t"])
-    if "vowels" in finfo:
-        for vidx, vow in enumerate(finfo["vowels"]):
-            for c, idx in finfo["ct"].items():
-                if idx >= lent:
-                    continue
-                r = finfo["t"][idx][0]+vow
-                print(fname+(str(vidx) if vidx > 0 else '')+","+str(ord(c))+","+r)
-        continue
-    for c, idx in finfo["ct"].items():
-        if idx >= lent:
+def font_rows():
+    """
+    yields (font name, code point, str) for all the characters of ALL_FONTS
+    """
+    for fname, finfo in ALL_FONTS.items():
+        if "dt" in finfo:
+            for c, r in finfo["dt"].items():
+                yield fname, ord(c), r
+            continue
+        lent = len(finfo["t"])
+        if "vowels" in finfo:
+            for vidx, vow in enumerate(finfo["vowels"]):
+                for c, idx in finfo["ct"].items():
+                    if idx >= lent:
+                        continue
+                    r = finfo["t"][idx][0]+vow
+                    yield fname+(str(vidx) if vidx > 0 else ''), ord(c), r
             continue
-        r = finfo["t"][idx][0]
-        print(fname+","+str(ord(c))+","+r)
\ No newline at end of file
+        for c, idx in finfo["ct"].items():
+            if idx >= lent:
+                continue
+            r = finfo["t"][idx][0]
+            yield fname, ord(c), r
+
+def generated_base():
+    """
+    the tables in the same form as font_tables.read_csv_table, tiblegenc.csv
+    has the strings in NFD
+    """
+    base = {}
+    for fname, cp, r in font_rows():
+        if fname not in base:
+            base[fname] = {}
+        base[fname][cp] = unicodedata.normalize("NFD", r)
+    return base
+
+def check_with_csv(base, csv_base):
+    """
+    returns the (font name, code point, generated str, csv str) where the
+    generated tables and tiblegenc.csv disagree
+    """
+    diffs = []
+    for fname in sorted(set(base) | set(csv_base)):
+        ft = base.get(fname, {})
+        csv_ft = csv_base.get(fname, {})
+        for cp in sorted(set(ft) | set(csv_ft)):
+            if ft.get(cp) != csv_ft.get(cp):
+                diffs.append((fname, cp, ft.get(cp), csv_ft.get(cp)))
+    return diffs
+
+def main():
+    parser = argparse.ArgumentParser(description="prints the tables as CSV (the content of tiblegenc.csv)")
+    parser.add_argument("--check", action="store_true", help="compare with font-tables/tiblegenc.csv")
+    parser.add_argument("--compile", action="store_true", help="write font-tables/compiled.bin with these tables instead of tiblegenc.csv")
+    parser.add_argument("--force", action="store_true", help="compile even if the tables disagree with tiblegenc.csv")
+    args = parser.parse_args()
+    if not args.check and not args.compile:
+        for fname, cp, r in font_rows():
+            print(fname+","+str(cp)+","+r)
+        return
+    base = generated_base()
+    sources = [(name, os.path.join(REPO_DIR, filename), fmt) for name, filename, fmt in font_tables.SOURCES]
+    diffs = check_with_csv(base, font_tables.read_csv_table(sources[0][1]))
+    for fname, cp, r, csv_r in diffs:
+        print("%s,%d: %s in generated tables, %s in tiblegenc.csv" % (fname, cp, r, csv_r), file=sys.stderr)
+    if diffs:
+        print("%d differences with tiblegenc.csv" % len(diffs), file=sys.stderr)
+    if diffs and not (args.compile and args.force):
+        sys.exit(1)
+    if args.compile:
+        font_tables.save_compiled_tables(font_tables.compile_tables(sources, {"tiblegenc": base}, os.path.join(REPO_DIR, font_tables.SEQUENCES_FILE)), os.path.join(REPO_DIR, font_tables.COMPILED_FILE))
+
+if __name__ == "__main__":
+    main()
@@ -22,8 +22,12 @@ from pdfminer.layout import LTTextBoxVertical
 from pdfminer.layout import LTTextGroup
 from pdfminer.layout import LTTextLine
 from pdfminer.utils import AnyIO, Point, Matrix, Rect, PathSegment, make_compat_str, compatible_encode_method
-from char_converter import convert_string
+from pdfminer.pdftypes import PDFStream, resolve1
+from pdfminer.psparser import literal_name
+import char_converter
+from char_converter import convert_string, normalize_font_name, resolve_font, reorder_stacks
 import logging
+from time import perf_counter
 
 from typing import (
     BinaryIO,
@@ -41,28 +45,109 @@ from typing import (
 
 USUAL_LA_PARAMS = LAParams(word_margin=10000, char_margin=1000)
 
+def resources_font_names(resources, seen=None):
+    """
+    returns the set of font names used in a resource dictionary, including
+    the resources of the form XObjects
+    """
+    if seen is None:
+        seen = set()
+    resources = resolve1(resources)
+    if not isinstance(resources, dict) or id(resources) in seen:
+        return set()
+    seen.add(id(resources))
+    res = set()
+    fonts = resolve1(resources.get("Font"))
+    if isinstance(fonts, dict):
+        for spec in fonts.values():
+            spec = resolve1(spec)
+            if isinstance(spec, dict) and "BaseFont" in spec:
+                res.add(literal_name(resolve1(spec["BaseFont"])))
+    xobjects = resolve1(resources.get("XObject"))
+    if isinstance(xobjects, dict):
+        for xobj in xobjects.values():
+            xobj = resolve1(xobj)
+            if isinstance(xobj, PDFStream) and literal_name(xobj.get("Subtype")) == "Form" and "Resources" in xobj:
+                res |= resources_font_names(xobj.get("Resources"), seen)
+    return res
+
+def page_font_names(page):
+    """
+    normalized names of the fonts in the resources of a page, without
+    interpreting it
+    """
+    return {normalize_font_name(font_name) for font_name in resources_font_names(page.resources)}
+
+def page_has_legacy_fonts(page):
+    return any(resolve_font(font_name)[1] is not None for font_name in resources_font_names(page.resources))
+
+def fast_lines(chars):
+    """
+    cheap replacement for the layout analysis: buckets the characters in
+    lines by baseline, keeping the content stream order in each line,
+    returns the lists of characters of each line from top to bottom
+    """
+    lines = []
+    for c in chars:
+        baseline = c.matrix[5]
+        tolerance = c.size * 0.5
+        # usually the character is on the same line as the previous one
+        if lines and abs(lines[-1][0] - baseline) <= tolerance:
+            lines[-1][1].append(c)
+            continue
+        for line in lines:
+            if abs(line[0] - baseline) <= tolerance:
+                line[1].append(c)
+                break
+        else:
+            lines.append([baseline, [c]])
+    lines.sort(key=lambda line: -line[0])
+    return [line[1] for line in lines]
+
 class DuffedTextConverter(PDFConverter[AnyIO]):
     def __init__(
         self,
         rsrcmgr: PDFResourceManager,
         outfp: AnyIO,
-        stats: dict,
+        stats,
         codec: str = "utf-8",
         pageno: int = 1,
         laparams: Optional[LAParams] = USUAL_LA_PARAMS,
         imagewriter = None,
         region = None,
         pbs = "\n\n-- page {} --\n\n",
+        fast_layout = False,
+        prescan = None,
+        recorder = None,
+        spans = None,
     ) -> None:
+        # in fast layout mode pdfminer's layout analysis is skipped, the
+        # characters are put in lines by fast_lines instead
+        if fast_layout:
+            laparams = None
         super().__init__(rsrcmgr, outfp, codec=codec, pageno=pageno, laparams=laparams)
+        self.fast_layout = fast_layout
+        # with prescan, pages with no font in the tables are not converted
+        # ("plain") or not interpreted at all ("skip"), see process_page
+        self.prescan = prescan
+        self.convert_fonts = True
+        # a glyph_stream.GlyphStreamWriter recording what is converted
+        self.recorder = recorder
+        # a glyph_stream.GlyphStreamWriter receiving the span stream: bbox,
+        # resolved font and converted text of each run
+        self.spans = spans
+        self.run_items = []
         self.imagewriter = imagewriter
-        self.region = region
+        self.region = None
         self.stats = stats
         if region:
             # adding x2 and y2
-            self.region.append(region[0]+region[2])
-            self.region.append(region[1]+region[3])
+            self.region = list(region[:4]) + [region[0]+region[2], region[1]+region[3]]
         self.pbs = pbs
+        self.run = []
+        self.run_fontname = None
+        self.page_parts = []
+        self.cur_page = None
 
     def in_region(self, item, ltpage):
         if not self.region or not hasattr(item, "x0"):
@@ -77,28 +162,114 @@ class DuffedTextConverter(PDFConverter[AnyIO]):
                 return False
         return True
 
+    def process_page(self, interpreter, page) -> None:
+        timings = self.stats.timings
+        if timings is None:
+            self._process_page(interpreter, page)
+            return
+        pageno = self.pageno
+        # seconds in end_page, convert_string and write_page, see
+        # timings.py for the stages
+        self.page_seconds = [0.0, 0.0, 0.0]
+        self.page_glyphs = 0
+        t0 = perf_counter()
+        self._process_page(interpreter, page)
+        total = perf_counter() - t0
+        end_page, convert, output = self.page_seconds
+        # end_page includes the conversion and output of the page, unless
+        # the page is skipped
+        layout = max(end_page - convert - output, 0.0)
+        timings.add_page(pageno, self.page_glyphs, [total - layout - convert - output, layout, convert, output])
+
+    def _process_page(self, interpreter, page) -> None:
+        if self.prescan is None or page_has_legacy_fonts(page):
+            interpreter.process_page(page)
+        elif self.prescan == "skip":
+            self.write_page_break(self.pageno)
+            self.write_page()
+            self.pageno += 1
+        else:
+            self.convert_fonts = False
+            try:
+                interpreter.process_page(page)
+            finally:
+                self.convert_fonts = True
+
     def convert_item(self, item, ltpage) -> None:
-        text = item.get_text()
-        if not hasattr(item, "fontname"):
-            self.write_text(text)
+        if not self.convert_fonts or not hasattr(item, "fontname"):
+            self.flush_run()
+            self.write_text(item.get_text())
             return
-        if not self.in_region(item, ltpage):
-            if hasattr(item, "x0"):
-               logging.debug("x0: %f, x1: %f, y0: %f, y1: %f, in_region=False" % (item.x0, item.x1, item.y0, item.y1))
+        # consecutive characters of the same font are converted in one call
+        if item.fontname != self.run_fontname:
+            self.flush_run()
+            self.run_fontname = item.fontname
+        self.run.append(item.get_text())
+        if self.recorder is not None or self.spans is not None:
+            self.run_items.append(item)
+
+    def flush_run(self) -> None:
+        if not self.run:
             return
-        fontname = item.fontname
-        fontname = fontname[fontname.find('+')+1:]
-        ctext = convert_string(text, fontname, self.stats)
+        text = "".join(self.run)
+        self.run = []
+        bbox = None
+        if self.run_items:
+            items = self.run_items
+            bbox = (min(i.x0 for i in items), min(i.y0 for i in items), max(i.x1 for i in items), max(i.y1 for i in items))
+            self.run_items = []
+        if self.recorder is not None:
+            self.recorder.run(self.run_fontname, text, bbox)
+        if self.stats.timings is None:
+            ctext = convert_string(text, self.run_fontname, self.stats)
+        else:
+            t0 = perf_counter()
+            ctext = convert_string(text, self.run_fontname, self.stats)
+            self.page_seconds[1] += perf_counter() - t0
+            self.page_glyphs += len(text)
         if ctext is not None:
             text = ctext
-        self.write_text(text)
+        if self.spans is not None:
+            self.spans.run(resolve_font(self.run_fontname)[0], text, bbox)
+        # the text of a page is written in one go in write_page
+        self.page_parts.append(text)
 
     def write_text(self, text: str) -> None:
+        if self.recorder is not None:
+            self.recorder.text(text)
+        self.page_parts.append(text)
+
+    def write_page_break(self, pageno) -> None:
+        if self.recorder is not None:
+            self.recorder.page(pageno)
+        if self.spans is not None:
+            self.spans.page(pageno)
+        self.page_parts.append(self.pbs.format(pageno))
+
+    def write_page(self) -> None:
+        if self.stats.timings is not None:
+            t0 = perf_counter()
+        text = "".join(self.page_parts)
+        if char_converter.REORDER:
+            # on the whole page, so that the stacks split across runs of
+            # different fonts are reordered too
+            text = reorder_stacks(text)
         text = compatible_encode_method(text, self.codec, "ignore")
+        self.page_parts = []
         if self.outfp_binary:
             cast(BinaryIO, self.outfp).write(text.encode())
         else:
             cast(TextIO, self.outfp).write(text)
+        if self.stats.timings is not None:
+            self.page_seconds[2] += perf_counter() - t0
+
+    def end_page(self, page) -> None:
+        if self.stats.timings is None:
+            super().end_page(page)
+            return
+        t0 = perf_counter()
+        super().end_page(page)
+        self.page_seconds[0] += perf_counter() - t0
 
     def receive_layout(self, ltpage: LTPage) -> None:
         def render(item: LTItem) -> None:
@@ -108,12 +279,51 @@ class DuffedTextConverter(PDFConverter[AnyIO]):
             elif isinstance(item, LTText):
                 self.convert_item(item, ltpage)
             if isinstance(item, LTTextBox):
+                self.flush_run()
                 self.write_text("\n")
             elif isinstance(item, LTImage):
                 if self.imagewriter is not None:
                     self.imagewriter.export_image(item)
-        self.write_text(self.pbs.format(ltpage.pageid))
-        render(ltpage)
+        self.write_page_break(ltpage.pageid)
+        if self.fast_layout:
+            self.render_fast_layout(ltpage)
+        else:
+            render(ltpage)
+        self.flush_run()
+        self.write_page()
+
+    def render_fast_layout(self, ltpage: LTPage) -> None:
+        chars = []
+        def collect(item: LTItem) -> None:
+            if isinstance(item, LTChar):
+                chars.append(item)
+            elif isinstance(item, LTContainer):
+                for child in item:
+                    collect(child)
+            elif isinstance(item, LTImage):
+                if self.imagewriter is not None:
+                    self.imagewriter.export_image(item)
+        collect(ltpage)
+        for line in fast_lines(chars):
+            for item in line:
+                self.convert_item(item, ltpage)
+            self.flush_run()
+            self.write_text("\n")
+
+    def begin_page(self, page, ctm) -> None:
+        super().begin_page(page, ctm)
+        self.cur_page = self.cur_item
+
+    def render_char(self, *args, **kwargs) -> float:
+        # characters out of the region are removed as soon as they are
+        # rendered so that they never go through the layout analysis
+        adv = super().render_char(*args, **kwargs)
+        if self.region:
+            item = self.cur_item._objs[-1]
+            if not self.in_region(item, self.cur_page):
+                logging.debug("x0: %f, x1: %f, y0: %f, y1: %f, in_region=False", item.x0, item.x1, item.y0, item.y1)
+                self.cur_item._objs.pop()
+        return adv
 
     # Some dummy functions to save memory/CPU when all that is wanted
     # is text.  This stops all the image and drawing output from being
@@ -0,0 +1,134 @@
+import logging
+
+from pdfminer.converter import PDFLayoutAnalyzer
+from pdfminer.pdfdocument import PDFDocument
+from pdfminer.pdfinterp import PDFResourceManager, PDFPageInterpreter
+from pdfminer.pdfpage import PDFPage
+from pdfminer.pdfparser import PDFParser
+
+from char_converter import resolve_font
+
+# Detection of the region of a document (the main text block, in the
+# format of DuffedTextConverter's region: x, y, w, h in PDF coordinates),
+# instead of a region tuned by hand for each collection. A few pages are
+# sampled, the boxes of the glyphs in legacy fonts only are collected and
+# their histograms on each axis are split in clusters separated by empty
+# gaps: the cluster with the most glyphs is the main text block, so that
+# headers, footers and marginal notes separated by a margin are left out.
+
+# width of the histogram bins, in PDF units (1/72 inch)
+BIN_SIZE = 4
+# gaps wider than that many median glyph sizes separate two clusters
+X_GAP = 4
+Y_GAP = 2.5
+
+class GlyphBoxCollector(PDFLayoutAnalyzer):
+    """
+    collects the boxes of the glyphs in fonts with a table, without layout
+    analysis and without keeping the characters
+    """
+    def __init__(self, rsrcmgr):
+        super().__init__(rsrcmgr, laparams=None)
+        self.boxes = []
+        self.legacy_fonts = {}
+
+    def render_char(self, *args, **kwargs) -> float:
+        adv = super().render_char(*args, **kwargs)
+        item = self.cur_item._objs.pop()
+        legacy = self.legacy_fonts.get(item.fontname)
+        if legacy is None:
+            legacy = self.legacy_fonts[item.fontname] = resolve_font(item.fontname)[1] is not None
+        if legacy:
+            self.boxes.append((item.x0, item.y0, item.x1, item.y1))
+        return adv
+
+    def receive_layout(self, ltpage) -> None:
+        pass
+
+def sample_indexes(nb_pages, nb_samples):
+    """
+    nb_samples page indexes spread over the document, leaving out the first
+    and last pages (covers, title pages) when there are enough pages
+    """
+    if nb_pages <= nb_samples:
+        return list(range(nb_pages))
+    first, last = (1, nb_pages - 1) if nb_pages > nb_samples + 2 else (0, nb_pages)
+    step = (last - first) / nb_samples
+    return sorted({first + int(step * (i + 0.5)) for i in range(nb_samples)})
+
+def main_interval(intervals, max_gap):
+    """
+    the (start, end) of the cluster of intervals with the most intervals,
+    clusters being separated by gaps of more than max_gap in the histogram
+    of their coverage
+    """
+    lo = min(start for start, _ in intervals)
+    nb_bins = int((max(end for _, end in intervals) - lo) // BIN_SIZE) + 1
+    # difference array of the coverage, and count of the centers per bin
+    coverage = [0] * (nb_bins + 1)
+    centers = [0] * nb_bins
+    for start, end in intervals:
+        coverage[int((start - lo) // BIN_SIZE)] += 1
+        coverage[int((end - lo) // BIN_SIZE) + 1] -= 1
+        centers[int(((start + end) / 2 - lo) // BIN_SIZE)] += 1
+    max_gap_bins = max(1, int(max_gap // BIN_SIZE))
+    best = None
+    cluster_start = None
+    weight = 0
+    depth = 0
+    empty = 0
+    for i in range(nb_bins):
+        depth += coverage[i]
+        if depth > 0:
+            if cluster_start is None:
+                cluster_start = i
+            weight += centers[i]
+            empty = 0
+            cluster_end = i
+            continue
+        empty += 1
+        if cluster_start is not None and empty > max_gap_bins:
+            if best is None or weight > best[0]:
+                best = (weight, cluster_start, cluster_end)
+            cluster_start = None
+            weight = 0
+    if cluster_start is not None and (best is None or weight > best[0]):
+        best = (weight, cluster_start, cluster_end)
+    _, start_bin, end_bin = best
+    return lo + start_bin * BIN_SIZE, lo + (end_bin + 1) * BIN_SIZE
+
+def median(values):
+    values = sorted(values)
+    return values[len(values) // 2]
+
+def region_from_boxes(boxes):
+    """
+    region (x, y, w, h) of the main block of glyph boxes, with a margin of
+    half a glyph, None without boxes
+    """
+    if not boxes:
+        return None
+    width = median(x1 - x0 for x0, _, x1, _ in boxes) or 1
+    height = median(y1 - y0 for _, y0, _, y1 in boxes) or 1
+    y0, y1 = main_interval([(box[1], box[3]) for box in boxes], Y_GAP * height)
+    # the x extent only of the glyphs of the main lines
+    x0, x1 = main_interval([(box[0], box[2]) for box in boxes if box[1] >= y0 and box[3] <= y1], X_GAP * width)
+    x0 -= width / 2
+    y0 -= height / 2
+    return [x0, y0, x1 + width / 2 - x0, y1 + height / 2 - y0]
+
+def detect_region(in_file, nb_samples=5):
+    """
+    region of the main text block of a PDF (a binary file), from the legacy
+    glyphs of nb_samples pages, None if these pages have none
+    """
+    doc = PDFDocument(PDFParser(in_file))
+    pages = list(PDFPage.create_pages(doc))
+    rsrcmgr = PDFResourceManager()
+    device = GlyphBoxCollector(rsrcmgr)
+    interpreter = PDFPageInterpreter(rsrcmgr, device)
+    for i in sample_indexes(len(pages), nb_samples):
+        interpreter.process_page(pages[i])
+    region = region_from_boxes(device.boxes)
+    logging.info("detected region %s from %d glyphs", region, len(device.boxes))
+    return region
@@ -0,0 +1,9 @@
+from setuptools import setup, Extension
+
+# only builds the optional native conversion kernel (see _convert_kernel.c),
+# the scripts run without it:
+#     python3 setup.py build_ext --inplace
+setup(
+    name="py-tiblegenc",
+    ext_modules=[Extension("_convert_kernel", ["_convert_kernel.c"], optional=True)],
+)
@@ -0,0 +1,25 @@
+import re
+from io import TextIOBase
+
+NEWLINES_PATT = re.compile(r"\n+")
+
+class NewlineCollapsingWriter(TextIOBase):
+    """
+    text sink collapsing runs of newlines into one newline, also across
+    writes, so that the output can be streamed page by page
+    """
+    def __init__(self, outfp):
+        self.outfp = outfp
+        self.after_newline = False
+
+    def writable(self):
+        return True
+
+    def write(self, text):
+        text = NEWLINES_PATT.sub("\n", text)
+        if self.after_newline and text.startswith("\n"):
+            text = text[1:]
+        if text:
+            self.outfp.write(text)
+            self.after_newline = text.endswith("\n")
+        return len(text)
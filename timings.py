@@ -0,0 +1,72 @@
+try:
+    # Unix only, the peak RSS is then not measured
+    import resource
+except ImportError:
+    resource = None
+
+# Optional instrumentation of the conversion: time spent in each stage of
+# each page, glyphs and pages per second, peak RSS. The stages are:
+#   interpret: PDF parsing and interpretation of the page content (which
+#              includes the region culling in render_char)
+#   layout: pdfminer's layout analysis and the walk of the layout tree
+#   convert: convert_string
+#   output: writing the text of the page
+
+STAGES = ["interpret", "layout", "convert", "output"]
+
+def peak_rss():
+    """
+    peak resident set size of the process, in kB (on Linux), None where
+    the resource module is missing (Windows)
+    """
+    if resource is None:
+        return None
+    return resource.getrusage(resource.RUSAGE_SELF).ru_maxrss
+
+class Timings:
+    """
+    seconds per stage, in total and for each page ([page number, glyphs,
+    seconds of each stage]), and wall time of the files
+    """
+    def __init__(self):
+        self.stages = dict.fromkeys(STAGES, 0.0)
+        self.pages = []
+        self.glyphs = 0
+        self.files = 0
+        self.seconds = 0.0
+        self.max_rss = 0
+
+    def add_page(self, pageno, glyphs, stage_seconds):
+        for stage, seconds in zip(STAGES, stage_seconds):
+            self.stages[stage] += seconds
+        self.glyphs += glyphs
+        self.pages.append([pageno, glyphs] + list(stage_seconds))
+
+    def add_file(self, seconds):
+        self.files += 1
+        self.seconds += seconds
+        self.max_rss = max(self.max_rss, peak_rss() or 0)
+
+    def merge(self, other):
+        for stage in STAGES:
+            self.stages[stage] += other.stages[stage]
+        self.pages += other.pages
+        self.glyphs += other.glyphs
+        self.files += other.files
+        self.seconds += other.seconds
+        self.max_rss = max(self.max_rss, other.max_rss)
+
+    def to_dict(self, pages=True):
+        res = {
+            "files": self.files,
+            "pages": len(self.pages),
+            "glyphs": self.glyphs,
+            "seconds": self.seconds,
+            "stages": dict(self.stages),
+            "glyphs_per_sec": self.glyphs / self.seconds if self.seconds else None,
+            "pages_per_sec": len(self.pages) / self.seconds if self.seconds else None,
+            "max_rss_kb": self.max_rss
+        }
+        if pages:
+            res["page_timings"] = [dict(zip(["page", "glyphs"] + STAGES, page)) for page in self.pages]
+        return res